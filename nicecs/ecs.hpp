@@ -24,6 +24,13 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <type_traits>
 #include <unordered_map>
 #include <algorithm>
+#include <limits>
+#include <utility>
+#include <iterator>
+#include <tuple>
+#include <functional>
+#include <atomic>
+#include <mutex>
 
 /*! \cond Doxygen_Suppress */
 // Config section 
@@ -52,6 +59,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #endif
 
 #include "sparse_set.hpp"
+#include "storage.hpp"
 
 /*! \endcond */
 
@@ -72,19 +80,189 @@ namespace ecs
     /// TODO: If MAX_COMPONENTS becomes an issue, use std::vector<bool>
     using signature = std::bitset<MAX_COMPONENTS>;
 
+    /// @brief The query id that represents no query.
+    constexpr std::uint32_t NULL_QUERY = std::numeric_limits<std::uint32_t>::max();
+
+namespace impl
+{
+    /// @brief An atomic that can be copied, so that the class holding it keeps its implicit copy. The copy itself is not atomic.
+    template<typename value_t>
+    struct copyable_atomic : public std::atomic<value_t>
+    {
+        copyable_atomic(value_t value = {}) : std::atomic<value_t>(value) {}
+        copyable_atomic(copyable_atomic const &other) : std::atomic<value_t>(other.load(std::memory_order_relaxed)) {}
+        copyable_atomic &operator=(copyable_atomic const &other) { this->store(other.load(std::memory_order_relaxed), std::memory_order_relaxed); return *this; }
+        using std::atomic<value_t>::operator=;
+    };
+} // namespace impl
+
+    /// @brief A query built at runtime from component ids.
+    /// The terms are compiled to signature masks, so matching a group costs a few bitset operations. Queries with the same terms share the cached groups, a query rebuilt every frame only pays for a lookup of its id.
+    /// @code
+    /// auto q = ecs::query{}.all<Position>().any<Velocity, Force>().none<Frozen>();
+    /// for(auto entity : registry.view(q)) {}
+    /// @endcode
+    class query
+    {
+    private:
+        signature mAll;
+        signature mAny;
+        signature mNone;
+        signature mOptional;
+        bool mAnyTerm = false;
+        // assigned on the first use of the query with a registry, reset when the terms change
+        mutable impl::copyable_atomic<std::uint32_t> mID = NULL_QUERY;
+
+        /// @brief The terms that affect matching, used to give queries with the same terms the same id.
+        struct key
+        {
+            signature all, any, none;
+            bool anyTerm;
+            bool operator==(key const &other) const;
+        };
+        struct key_hash
+        {
+            std::size_t operator()(key const &key) const;
+        };
+
+        inline static std::atomic<std::uint32_t> mNextID{0};
+        inline static std::mutex mIDsMutex;
+        inline static std::unordered_map<key, std::uint32_t, key_hash> mIDs;
+    public:
+        /// @brief Get a new unique query id. Ids are used by the registries to cache the groups matching a query. Thread safe.
+        static std::uint32_t nextID();
+
+        query() = default;
+
+        /// @brief Entities must have the component.
+        query &all(component_id id);
+        /// @brief Entities must have at least one of the components of the any terms.
+        /// A query with an empty any term matches no entities.
+        query &any(component_id id);
+        /// @brief Entities must not have the component.
+        query &none(component_id id);
+        /// @brief Entities may have the component. Does not affect matching, the term tells the consumer of the query which components it may read.
+        query &optional(component_id id);
+
+        /// @copydoc all
+        template<typename... Component>
+        query &all();
+        /// @copydoc any
+        template<typename... Component>
+        query &any();
+        /// @copydoc none
+        template<typename... Component>
+        query &none();
+        /// @copydoc optional
+        template<typename... Component>
+        query &optional();
+
+        /// @brief Get the mask of the all terms.
+        signature const &all_mask() const;
+        /// @brief Get the mask of the any terms.
+        signature const &any_mask() const;
+        /// @brief Get the mask of the none terms.
+        signature const &none_mask() const;
+        /// @brief Get the mask of the optional terms.
+        signature const &optional_mask() const;
+
+        /// @brief Check whether a signature matches the query.
+        bool matches(signature const &signature) const;
+
+        /// @brief Get the id of the query, used to cache the matching groups.
+        /// Queries with the same all, any and none terms have the same id, so a query built every frame reuses the same cache. Thread safe.
+        std::uint32_t id() const;
+    };
+
 namespace impl
 {
+    /// @brief True if the storage engine replaces elements itself (e.g. ecs::shared_storage).
+    template<typename storage_t, typename = void>
+    constexpr bool hasReplace = false;
+    template<typename storage_t>
+    constexpr bool hasReplace<storage_t, std::void_t<decltype(std::declval<storage_t &>().replace(std::declval<typename storage_t::sparse_type const &>(), std::declval<typename storage_t::dense_type const &>()))>> = true;
+
+    /// @brief True if the storage engine copies elements of another storage itself, e.g. every buffer of ecs::double_buffered.
+    template<typename storage_t, typename = void>
+    constexpr bool hasCopy = false;
+    template<typename storage_t>
+    constexpr bool hasCopy<storage_t, std::void_t<decltype(std::declval<storage_t &>().copy(std::declval<typename storage_t::sparse_type const &>(), std::declval<storage_t const &>(), std::declval<typename storage_t::sparse_type const &>()))>> = true;
+
+    /// @brief A list of types.
+    template<typename... Type>
+    struct type_list {};
+
+    /// @brief True if @p type_t is one of @p Types.
+    template<typename type_t, typename... Types>
+    constexpr bool isAnyOf = (std::is_same_v<type_t, Types> || ...);
+
+    /// @brief Index of an entity group.
+    using group_index = std::uint32_t;
+
+    /// @brief The group index that represents no group.
+    constexpr group_index NULL_GROUP = std::numeric_limits<group_index>::max();
+
+    /// @brief The groups matching a query, updated as new groups appear.
+    struct QueryCache
+    {
+        query terms;
+        std::vector<group_index> groups;
+    };
+
+    /// @brief Components owned by a group.
+    /// The entities that have all the owned components are packed at the front of every owned component array, in the same order.
+    struct OwningGroup
+    {
+        signature owned;
+        std::vector<component_id> components;
+        /// @brief The number of entities in the group, the length of the packed prefix.
+        std::size_t size = 0;
+    };
 
     /// @brief Manages entities (create, destroy) and their signatures (set, get).
+    /// Entities with the same signature are stored together in a group. Emptied groups are kept, so a group index stays valid until pruneGroups.
     /// Any entity supplied to the manager must be created by the same manager object.
     class EntityManager
     {
     private:
+        /// @brief Where an entity is stored.
+        struct EntityRecord
+        {
+            group_index group = NULL_GROUP;
+            std::uint32_t index = 0;
+            /// @brief Incremented every time the entity is destroyed.
+            std::uint32_t generation = 0;
+        };
+
         std::vector<entity> mAvailableEntityIDs;
-        std::unordered_map<signature, sparse_set<entity>> mEntityGroups;
+        /// @brief The records of the identifiers from mFirstRecord on.
+        std::vector<EntityRecord> mRecords;
+        /// @brief 0, unless the manager adopts entities. A staging registry then keeps records for its own identifiers only.
+        entity mFirstRecord = 0;
+        std::vector<signature> mGroupSignatures;
+        std::vector<std::vector<entity>> mGroups;
+        /// @brief The version of the last change of every group.
+        std::vector<std::uint64_t> mGroupVersions;
+        std::unordered_map<signature, group_index> mGroupIndices;
+        std::vector<std::vector<group_index>> mComponentGroups;
+        sparse_set<QueryCache> mQueries;
         std::uint32_t mLivingEntitiesCount = 0;
-        sparse_set<signature> mSignatures;
-        entity mNextID = 1;
+        std::uint64_t mVersion = 0;
+        copyable_atomic<entity> mNextID = 1;
+
+        EntityRecord &getRecord(entity const &entity);
+        EntityRecord const &getRecord(entity const &entity) const;
+        /// @brief Make room for the record of an identifier.
+        void growRecords(entity const &entity);
+        group_index getGroup(signature const &signature);
+        void addToGroup(entity const &entity, group_index group);
+        void removeFromGroup(entity const &entity);
+    public:
+        /// @brief Get unique query ID used to cache the matching groups.
+        /// @tparam query_t A type describing the query.
+        /// The id is the same between the managers.
+        template <typename query_t>
+        static std::uint32_t getQueryID();
     public:
         explicit EntityManager();
         ~EntityManager() = default;
@@ -94,6 +272,35 @@ namespace impl
         /// @return Unique entity id.
         entity createEntity(signature signature = {});
 
+        /// @brief Reserve a fresh entity identifier, to be created later with createReserved or given back with releaseReserved.
+        /// Thread safe against other reservations. Freed identifiers are not reused.
+        /// @return The reserved identifier. It is not valid until created.
+        entity reserveEntity();
+
+        /// @brief Creates an entity with a reserved identifier.
+        /// @param entity An identifier returned by reserveEntity.
+        /// @param signature A signature representing components the entity has (optional).
+        void createReserved(entity const &entity, signature signature = {});
+
+        /// @brief Creates entities with reserved identifiers and the same signature, appending them to their group at once.
+        /// @param entities Identifiers returned by reserveEntity.
+        /// @param signature A signature representing components the entities have.
+        void createReserved(std::vector<entity> const &entities, signature signature);
+
+        /// @brief Creates an entity with an identifier reserved from another manager, e.g. the target of a staging_registry.
+        /// Identifiers handed out afterwards by this manager may collide with it.
+        /// @param entity An identifier not valid in this manager.
+        /// @param signature A signature representing components the entity has (optional).
+        void adoptEntity(entity const &entity, signature signature = {});
+
+        /// @brief Drop every entity without giving the identifiers back, e.g. once they were moved to another manager.
+        /// The groups and their capacity are kept.
+        void forgetEntities();
+
+        /// @brief Give back a reserved identifier that was not created, so that it can be reused.
+        /// @param entity An identifier returned by reserveEntity.
+        void releaseReserved(entity const &entity);
+
         /// @brief Destroys entity.
         /// @param entity A valid entity identifier.
         void destroyEntity(entity const &entity);
@@ -105,12 +312,60 @@ namespace impl
 
         /// @brief Gets the signature of a valid entity.
         /// @param entity A valid entity identifier.
-        /// @return A const reference to a signature, describing the components an entity has.
+        /// @return A const reference to a signature, describing the components an entity has. Invalidated when a new group is created or the groups are pruned.
         signature const &getSignature(entity const &entity) const;
 
-        /// @brief Get entities of this manager.
-        /// @return Get a map of the sparse sets of all the valid entities of this registry with their signatures as its key.
-        std::unordered_map<signature, sparse_set<entity>> const &getEntityGroups() const;
+        /// @brief Gets the generation of an identifier, incremented every time an entity with it is destroyed.
+        /// An identifier reused after destroy has a different generation, so it can be told apart from the destroyed entity.
+        /// @param entity An identifier, either valid or not.
+        std::uint32_t getGeneration(entity const &entity) const;
+
+        /// @brief Gets the group of a valid entity.
+        /// @param entity A valid entity identifier.
+        group_index getGroupIndex(entity const &entity) const;
+
+        /// @brief Get the signatures of the groups. 1 to 1 with getGroups.
+        std::vector<signature> const &getGroupSignatures() const;
+
+        /// @brief Get the entity groups of this manager.
+        /// @return The lists of the entities that share the same signature, indexed by group_index. Some of the groups may be empty.
+        std::vector<std::vector<entity>> const &getGroups() const;
+
+        /// @brief Get a copy of the non-empty entity groups, keyed by their signature.
+        /// @deprecated Copies every group, use getGroups and getGroupSignatures.
+        [[deprecated("Use getGroups and getGroupSignatures")]]
+        std::unordered_map<signature, sparse_set<entity>> getEntityGroups() const;
+
+        /// @brief Remove the empty groups, e.g. after many component combinations were used once.
+        /// The remaining groups keep their order, their indices change. Cached queries are updated.
+        void pruneGroups();
+
+        /// @brief Get the groups whose signature contains a component.
+        /// @param id The component id.
+        std::vector<group_index> const &getComponentGroups(component_id id) const;
+
+        /// @brief Get the shortest list of groups containing one of the all terms of a query.
+        /// Every group matching the query is in the list.
+        /// @return The list, nullptr if the query has no all terms.
+        std::vector<group_index> const *getRarestGroups(query const &terms) const;
+
+        /// @brief Call func(group_index) for every group matching a query, in no particular order.
+        /// Only the groups containing the rarest all term are tested. Queries with only any terms test the groups of each any term once.
+        /// @param func Returns true to continue, false to stop.
+        template<typename func_t>
+        void forEachMatchingGroup(query const &terms, func_t &&func) const;
+
+        /// @brief Register a query, so that the groups matching it are cached and updated as new groups are created.
+        /// Multiple calls with the same id will do nothing.
+        /// @param id The query id, see getQueryID and query::id.
+        /// @param terms The query.
+        /// @return The query cache.
+        QueryCache const &registerQuery(std::uint32_t id, query const &terms);
+
+        /// @brief Get a registered query.
+        /// @param id The query id, see getQueryID and query::id.
+        /// @return The query cache, nullptr if the query is not registered.
+        QueryCache const *findQuery(std::uint32_t id) const;
 
         /// @brief Checks if an identifier refers to a valid entity.
         /// @param entity An identifier, either valid or not.
@@ -119,6 +374,17 @@ namespace impl
 
         /// @brief Get the number of entities alive in a manager.
         std::size_t size() const;
+
+        /// @brief Get the structural version. Changes every time an entity enters or leaves a group.
+        std::uint64_t version() const;
+        /// @brief Get the structural version of a component. Changes every time an entity enters or leaves a group containing the component.
+        /// @param id The component id.
+        /// @return The version of the last change, at most version().
+        std::uint64_t version(component_id id) const;
+
+        /// @brief Get the memory used to keep track of the entities (entity records, free identifiers, group table, component to group index, query caches).
+        /// The groups themselves are not included.
+        memory_stats memoryUsage() const;
     };
 
     /// @brief Every instanced component_array is derived from this polymorphic class.
@@ -147,14 +413,51 @@ namespace impl
 
         /// @brief Create a copy of the component array.
         virtual std::unique_ptr<IComponentArray> clone() const = 0;
+
+        /// @brief Replace the contents with a copy of another component array of the same type.
+        /// Reuses the allocated memory.
+        /// @param other The other component array.
+        virtual void assign(IComponentArray const *other) = 0;
+
+        /// @brief Get the memory used by the component array.
+        virtual memory_stats memoryUsage() const = 0;
+
+        /// @brief Get the entity stored at a dense position.
+        /// @param index A dense position, less than the number of stored components.
+        virtual entity entityAt(std::size_t index) const = 0;
+
+        /// @brief Get the entities that have the component, in dense order.
+        virtual std::vector<std::size_t> const &entities() const = 0;
+
+        /// @brief Check whether the array supports indexOf and swapEntities.
+        virtual bool swappable() const = 0;
+
+        /// @brief Get the dense position of the component of an entity.
+        /// Only supported by sparse_set storages.
+        /// @param entity An entity that has the component.
+        virtual std::size_t indexOf(entity const &entity) const = 0;
+
+        /// @brief Swap the dense positions of the components of two entities.
+        /// Only supported by sparse_set storages.
+        /// @param lhs An entity that has the component.
+        /// @param rhs An entity that has the component.
+        virtual void swapEntities(entity const &lhs, entity const &rhs) = 0;
+
+        /// @brief Move every component of another array of the same type to the end of this one, and clear it.
+        /// @param other An array whose entities are not in this one.
+        virtual void appendFrom(IComponentArray *other) = 0;
     };
 
-    /// @brief Stores components of entities of a specific type as a sparse set.
+    /// @brief Stores components of entities of a specific type.
+    /// The storage engine is selected by ecs::storage_traits.
     /// @tparam component_t The type of stored components.
     template <typename component_t>
-    class ComponentArray : public IComponentArray, public sparse_set<component_t>
+    class ComponentArray : public IComponentArray, public storage_traits<component_t>::storage_type
     {
     public:
+        /// @brief The storage engine of the component.
+        using storage_type = typename storage_traits<component_t>::storage_type;
+
         /// @brief The size of a component page in bytes.
         static constexpr std::size_t PAGE_SIZE = 4096;
 
@@ -174,6 +477,32 @@ namespace impl
 
         /// @copydoc ecs::impl::IComponentArray::clone
         std::unique_ptr<IComponentArray> clone() const override;
+
+        /// @copydoc ecs::impl::IComponentArray::assign
+        void assign(IComponentArray const *other) override;
+
+        /// @copydoc ecs::impl::IComponentArray::memoryUsage
+        memory_stats memoryUsage() const override;
+
+        /// @copydoc ecs::impl::IComponentArray::entityAt
+        entity entityAt(std::size_t index) const override;
+
+        /// @copydoc ecs::impl::IComponentArray::entities
+        std::vector<std::size_t> const &entities() const override;
+
+        /// @copydoc ecs::impl::IComponentArray::swappable
+        bool swappable() const override;
+
+        /// @copydoc ecs::impl::IComponentArray::indexOf
+        std::size_t indexOf(entity const &entity) const override;
+
+        /// @copydoc ecs::impl::IComponentArray::swapEntities
+        void swapEntities(entity const &lhs, entity const &rhs) override;
+
+        /// @copydoc ecs::impl::IComponentArray::appendFrom
+        void appendFrom(IComponentArray *other) override;
+    private:
+        static storage_type makeStorage();
     };
 
     /// @brief Manages components and their arrays. All components are destroyed automatically.
@@ -181,7 +510,7 @@ namespace impl
     {
     private:
         sparse_set<std::unique_ptr<IComponentArray>> mComponentArrays;
-        inline static component_id mNextID = 0;
+        inline static std::atomic<component_id> mNextID{0};
     public:
         /// @brief Get unique component ID used to index the signature bitset.
         /// @tparam component_t The component type.
@@ -194,7 +523,9 @@ namespace impl
     public:
         ComponentManager() = default;
         ComponentManager(ComponentManager const &other);
+        ComponentManager(ComponentManager &&other) noexcept = default;
         ComponentManager &operator=(ComponentManager const &other);
+        ComponentManager &operator=(ComponentManager &&other) noexcept = default;
         ~ComponentManager() = default;
 
         /// @brief Registers component.
@@ -218,10 +549,111 @@ namespace impl
         template <typename component_t>
         impl::ComponentArray<component_t> const *getComponentArray() const;
 
+        /// @brief Get the component array associated with the given component type, if it is registered.
+        /// @tparam component_t The component type.
+        /// @return The component array, nullptr if the component is not registered.
+        template <typename component_t> 
+        impl::ComponentArray<component_t> *findComponentArray();
+        /// @copydoc findComponentArray
+        template <typename component_t>
+        impl::ComponentArray<component_t> const *findComponentArray() const;
+
         sparse_set<std::unique_ptr<IComponentArray>> &getComponentArrays();
         sparse_set<std::unique_ptr<IComponentArray>> const &getComponentArrays() const;
     };
 
+    /// @brief Every context variable is derived from this polymorphic class.
+    class IContextVariable
+    {
+    public:
+        IContextVariable() = default;
+        virtual ~IContextVariable() = default;
+
+        /// @brief Create a copy of the context variable.
+        virtual std::unique_ptr<IContextVariable> clone() const = 0;
+    };
+
+    /// @brief Holds a single context variable of a specific type.
+    /// @tparam value_t The type of the variable.
+    template <typename value_t>
+    class ContextVariable : public IContextVariable
+    {
+    public:
+        value_t value;
+
+        template <class... Args>
+        explicit ContextVariable(Args&&... args);
+
+        /// @copydoc ecs::impl::IContextVariable::clone
+        std::unique_ptr<IContextVariable> clone() const override;
+    private:
+        template <class... Args>
+        static value_t construct(Args&&... args);
+    };
+
+    /// @brief Stores registry-wide variables (singletons), at most one per type.
+    /// Context variables are not entities and do not show up in views.
+    class ContextManager
+    {
+    private:
+        sparse_set<std::unique_ptr<IContextVariable>> mVariables;
+        inline static std::atomic<std::uint32_t> mNextID{0};
+    public:
+        /// @brief Get unique context variable ID used to index the context.
+        /// @tparam value_t The variable type.
+        /// The id is the same between the managers.
+        template <typename value_t>
+        static std::uint32_t getContextID();
+    public:
+        ContextManager() = default;
+        ContextManager(ContextManager const &other);
+        ContextManager(ContextManager &&other) noexcept = default;
+        ContextManager &operator=(ContextManager const &other);
+        ContextManager &operator=(ContextManager &&other) noexcept = default;
+        ~ContextManager() = default;
+
+        /// @brief Constructs a context variable in place.
+        /// If the variable is already present, it is replaced.
+        /// @tparam value_t The variable type.
+        /// @param args Arguments forwarded to construct the variable.
+        /// @return The variable lvalue reference.
+        template <typename value_t, class... Args>
+        value_t &emplace(Args&&... args);
+
+        /// @brief Gets a context variable.
+        /// @tparam value_t The variable type.
+        /// @throws std::out_of_range If the variable is not present.
+        /// @return The variable lvalue reference.
+        template <typename value_t>
+        value_t &get();
+        /// @copydoc get
+        template <typename value_t>
+        value_t const &get() const;
+
+        /// @brief Gets a context variable, if present.
+        /// @tparam value_t The variable type.
+        /// @return A pointer to the variable, nullptr if the variable is not present.
+        template <typename value_t>
+        value_t *find();
+        /// @copydoc find
+        template <typename value_t>
+        value_t const *find() const;
+
+        /// @brief Checks if a context variable is present.
+        /// @tparam value_t The variable type.
+        template <typename value_t>
+        bool contains() const;
+
+        /// @brief Removes a context variable.
+        /// @tparam value_t The variable type.
+        /// @throws std::out_of_range If the variable is not present.
+        template <typename value_t>
+        void erase();
+
+        /// @brief Get the number of context variables.
+        std::size_t size() const;
+    };
+
 }; // namespace impl
 
     /// @brief Exclusion type list.
@@ -230,14 +662,297 @@ namespace impl
     template<typename... Type>
     struct exclude {};
 
+    /// @brief The iteration strategy chosen for a view, see basic_view::plan.
+    struct view_plan
+    {
+        enum class strategy
+        {
+            /// @brief Walk the entity groups that match the query.
+            group_scan,
+            /// @brief Walk the entities of the smallest included component array, and test the signature of each one.
+            pivot
+        };
+
+        strategy kind = strategy::group_scan;
+        /// @brief True if the group scan walks the groups cached for the query instead of testing the groups of the rarest component.
+        bool cached = false;
+        /// @brief The number of groups the group scan would walk.
+        std::size_t groups = 0;
+        /// @brief The smallest included component array.
+        component_id pivot = 0;
+        /// @brief The number of entities in the smallest included component array, 0 if the query has no all terms.
+        std::size_t pivotSize = 0;
+        /// @brief The estimated cost of the chosen strategy.
+        std::size_t cost = 0;
+    };
+
+    /// @brief A lazy view on the entities of a registry.
+    /// Walks the matching entity groups directly, without allocating or copying.
+    /// The view is invalidated by any structural change (create, destroy, emplace, remove) in the registry.
+    /// @tparam registry_t The (possibly const) registry type.
+    /// @tparam Include Types of included elements.
+    template<typename registry_t, typename... Include>
+    class basic_view
+    {
+    private:
+        using group_list = std::vector<std::vector<entity>>;
+        template<typename component_t>
+        using array_pointer = std::conditional_t<std::is_const_v<registry_t>, impl::ComponentArray<component_t> const *, impl::ComponentArray<component_t> *>;
+        template<typename component_t>
+        using component_reference = std::conditional_t<std::is_const_v<registry_t>, component_t const &, storage_reference<component_t>>;
+        template<typename component_t>
+        using component_pointer = std::conditional_t<std::is_const_v<registry_t>, component_t const *, component_t *>;
+        using arrays_type = std::tuple<array_pointer<Include>...>;
+
+        registry_t *mRegistry;
+        query mTerms;
+        std::uint32_t mQuery;
+        view_plan mPlan;
+
+        arrays_type getArrays() const;
+        /// @brief Choose the iteration strategy, see plan.
+        view_plan makePlan() const;
+        /// @brief Get the cached groups of the query, nullptr if the query is not registered.
+        impl::QueryCache const *getQuery() const;
+        /// @brief Call func(std::vector<entity> const &) for every matching group.
+        template<typename func_t>
+        void forEachGroup(func_t &&func) const;
+        /// @brief Split the matching groups in chunks of at most @p grain entities, in group order.
+        std::vector<std::pair<entity const *, entity const *>> getChunks(std::size_t grain) const;
+        /// @brief Get the entities of the pivot array.
+        std::vector<std::size_t> const &getPivot() const;
+        /// @brief Call func(entity) for every matching entity of the pivot array.
+        template<typename func_t>
+        void forEachPivot(func_t &&func) const;
+    public:
+        /// @brief Forward iterator over the entities of the view.
+        class iterator
+        {
+            basic_view const *mView;
+            group_list const *mGroups;
+            impl::group_index const *mList; // nullptr if every group is walked
+            bool mVerify; // test the groups against the query
+            std::vector<entity> const *mCurrent;
+            std::vector<std::size_t> const *mPivot; // nullptr if the groups are scanned
+            std::size_t mCursor;
+            std::size_t mCount;
+            std::size_t mIndex;
+            entity mEntity;
+
+            void skipGroups();
+            void skipEntities();
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = entity;
+            using difference_type = std::ptrdiff_t;
+            using pointer = entity const *;
+            /// @brief The entity by value, a pivot iterator holds the entity it points to.
+            using reference = entity;
+
+            iterator() = default;
+            iterator(basic_view const *view, std::vector<impl::group_index> const *groups, bool verify, std::vector<std::size_t> const *pivot, std::size_t cursor);
+
+            inline reference operator*() const { return mPivot ? mEntity : (*mCurrent)[mIndex]; }
+            inline pointer operator->() const { return mPivot ? &mEntity : &(*mCurrent)[mIndex]; }
+
+            iterator &operator++();
+            inline iterator operator++(int) { iterator tmp = *this; ++*this; return tmp; }
+
+            inline bool operator==(iterator const &o) const { return mCursor == o.mCursor && mIndex == o.mIndex; }
+            inline bool operator!=(iterator const &o) const { return !(*this == o); }
+        };
+
+        /// @param registry The registry to view.
+        /// @param terms The query, that entities must match.
+        /// @param cached The id of the cached query, see impl::EntityManager::getQueryID. If the query is not registered, every group is tested.
+        basic_view(registry_t &registry, query const &terms, std::uint32_t cached = NULL_QUERY);
+
+        /// @brief Get how the view is iterated.
+        /// A group scan costs the number of groups it tests, a pivot costs the number of entities in the smallest included component array.
+        /// The cheaper strategy is chosen once, when the view is made, and used by the iteration, each, size and to_vector. Call it to explain the choice.
+        view_plan const &plan() const;
+
+        /// @brief The first entity of the view.
+        iterator begin() const;
+        /// @brief The end of the view.
+        iterator end() const;
+
+        /// @brief Get the number of entities in the view.
+        /// Takes time proportional to the cost of the plan, see plan.
+        std::size_t size() const;
+
+        /// @return True if the view has no entities, false otherwise.
+        bool empty() const;
+
+        /// @brief Copy the entities of the view.
+        /// The copy stays valid after structural changes of the registry.
+        std::vector<entity> to_vector() const;
+
+        /// @brief Forward iterator over the entities of the view with their included components.
+        /// Dereferences to std::tuple<entity, Include &...>.
+        class each_iterator
+        {
+            iterator mIterator;
+            arrays_type mArrays;
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::tuple<entity, component_reference<Include>...>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            each_iterator() = default;
+            inline each_iterator(iterator it, arrays_type const &arrays) : mIterator(it), mArrays(arrays) {}
+
+            inline reference operator*() const { entity e = *mIterator; return {e, std::get<array_pointer<Include>>(mArrays)->get(e)...}; }
+
+            inline each_iterator &operator++() { ++mIterator; return *this; }
+            inline each_iterator operator++(int) { each_iterator tmp = *this; ++mIterator; return tmp; }
+
+            inline bool operator==(each_iterator const &o) const { return mIterator == o.mIterator; }
+            inline bool operator!=(each_iterator const &o) const { return !(*this == o); }
+        };
+
+        /// @brief A range of each_iterator.
+        /// Holds a copy of the view, so that the range outlives a temporary view in a range based for loop.
+        class each_range;
+
+        /// @brief Calls a function for every entity of the view with its included components.
+        /// The component arrays are resolved once per call, every component costs one sparse lookup per entity.
+        /// If the included components are arranged (see registry::arrange), every group is walked linearly instead.
+        /// @param func Called as func(entity, Include &...) or func(Include &...).
+        template<typename func_t>
+        void each(func_t &&func) const;
+
+        /// @brief Calls a function for every entity of the view with its included components, spread over the threads of a pool.
+        /// The matching groups are split into chunks of @p grain entities, every chunk is one task of the pool.
+        /// The function may only read and write the included components of the entity it gets. Structural changes and access to other entities or components are data races.
+        /// @param pool Any type with parallel_for(count, func), that calls func(index) for every index in [0, count) and waits for the calls (e.g. ecs::thread_pool).
+        /// @param func Called as func(entity, Include &...) or func(Include &...), from several threads at once.
+        /// @param grain The number of entities in a chunk.
+        template<typename pool_t, typename func_t>
+        void par_each(pool_t &pool, func_t &&func, std::size_t grain = 1024) const;
+
+        /// @brief Like par_each, with a command buffer per chunk for structural changes.
+        /// The buffers are played back in chunk order once every chunk is done. The chunks only depend on the groups,
+        /// so in a deterministic registry (see registry::set_deterministic) the result does not depend on the threads.
+        /// @param pool Any type with parallel_for(count, func), see par_each.
+        /// @param func Called as func(command_buffer &, entity, Include &...) or func(command_buffer &, Include &...), from several threads at once.
+        /// The buffers are dropped after playback, record command_buffer::then to use the identifiers of the created entities.
+        /// @param grain The number of entities in a chunk.
+        template<typename pool_t, typename func_t>
+        void par_each_commands(pool_t &pool, func_t &&func, std::size_t grain = 1024) const;
+
+        /// @brief Get an iterable over the entities of the view with their included components.
+        /// @code
+        /// for(auto [entity, position, velocity] : registry.view<Position, Velocity>().each()) {}
+        /// @endcode
+        each_range each() const;
+    };
+
+    template<typename registry_t, typename... Include>
+    class basic_view<registry_t, Include...>::each_range
+    {
+        basic_view mView;
+        arrays_type mArrays;
+    public:
+        inline explicit each_range(basic_view const &view) : mView(view), mArrays(view.getArrays()) {}
+        inline each_iterator begin() const { return {mView.begin(), mArrays}; }
+        inline each_iterator end() const { return {mView.end(), mArrays}; }
+    };
+
+    /// @brief An owning group of a registry.
+    /// The registry keeps the owned component arrays arranged, so that the entities having all the owned components form the same prefix of each array.
+    /// Iteration walks the dense arrays in lockstep, without sparse lookups.
+    /// The group is invalidated by any structural change in the registry.
+    /// @tparam registry_t The (possibly const) registry type.
+    /// @tparam Owned Types of owned components.
+    template<typename registry_t, typename... Owned>
+    class basic_group
+    {
+    private:
+        template<typename component_t>
+        using component_pointer = std::conditional_t<std::is_const_v<registry_t>, component_t const *, component_t *>;
+
+        registry_t *mRegistry;
+        std::size_t mGroup;
+    public:
+        /// @brief Random access iterator over the entities of the group.
+        using iterator = typename sparse_set<std::tuple_element_t<0, std::tuple<Owned...>>>::sparse_type const *;
+
+        /// @param registry The registry of the group.
+        /// @param group The index of the group in the registry, see registry::getOwningGroups.
+        basic_group(registry_t &registry, std::size_t group);
+
+        /// @brief Get the number of entities in the group.
+        std::size_t size() const;
+
+        /// @return True if the group has no entities, false otherwise.
+        bool empty() const;
+
+        /// @brief The first entity of the group.
+        iterator begin() const;
+        /// @brief The end of the group.
+        iterator end() const;
+
+        /// @brief Copy the entities of the group.
+        /// The copy stays valid after structural changes of the registry.
+        std::vector<entity> to_vector() const;
+
+        /// @brief Calls a function for every entity of the group with its owned components.
+        /// @param func Called as func(entity, Owned &...) or func(Owned &...).
+        template<typename func_t>
+        void each(func_t &&func) const;
+    };
+
+    /// @brief Memory used by a registry.
+    struct registry_memory_stats
+    {
+        /// @brief Memory used by every component array, with its component id.
+        std::vector<std::pair<component_id, memory_stats>> components;
+        /// @brief Memory used by every entity group, with its signature.
+        std::vector<std::pair<signature, memory_stats>> groups;
+        /// @brief Memory used to keep track of the entities.
+        memory_stats entities;
+
+        /// @brief Get the total number of allocated bytes.
+        std::size_t total() const;
+    };
+
     /// @brief An ECS interface.
     /// Contains entities and their components.
+    /// The const member functions (valid, has, get, view, count, any, ...) and the const views never write, so any number of threads may call them at once, as long as no thread changes the registry meanwhile.
     class registry
     {
     private:
         impl::EntityManager mEntityManager;
-        // ugly fix for lazy component registration.
-        mutable impl::ComponentManager mComponentManager;
+        impl::ComponentManager mComponentManager;
+        impl::ContextManager mContext;
+        std::vector<impl::OwningGroup> mOwningGroups;
+        signature mArrangedComponents;
+        std::uint64_t mArrangedVersion = 0;
+        bool mDeterministic = false;
+        /// @brief Set while several systems of a scheduler share the registry. The views do not register their queries then, they test the groups instead.
+        bool mQueriesLocked = false;
+
+        /// @brief Count the entities matching a query, summing the sizes of the matching groups.
+        /// @param stopAtFirst Return as soon as a matching entity is found.
+        std::size_t countMatching(query const &terms, std::uint32_t id, bool stopAtFirst) const;
+
+        /// @brief Move an entity that has all the owned components to the packed prefix of the group.
+        void enterOwningGroup(impl::OwningGroup &group, entity const &entity);
+        /// @brief Move an entity out of the packed prefix of the group, before it loses one of the owned components.
+        void leaveOwningGroup(impl::OwningGroup &group, entity const &entity);
+        /// @brief Update the owning groups of an entity that got the @p changed components.
+        void enterOwningGroups(entity const &entity, signature const &changed);
+        /// @brief Update the owning groups of an entity that is about to lose the @p changed components.
+        void leaveOwningGroups(entity const &entity, signature const &changed);
+
+        friend class command_buffer;
+        friend class staging_registry;
+        friend class scheduler;
+        template<typename... Components>
+        friend class snapshot;
     public:
         registry() = default;
         ~registry() = default;
@@ -262,9 +977,9 @@ namespace impl
         /// @tparam component_t The component type.
         /// @throws std::invalid_argument if the entity is not a valid identifier.
         /// @throws std::out_of_range if the component is not added.
-        /// @return The component lvalue reference.
+        /// @return The component lvalue reference. Const for components in a storage that shares them, see storage_reference.
         template <typename component_t> 
-        component_t &get(entity const &entity);
+        storage_reference<component_t> get(entity const &entity);
         /// @copydoc get
         template <typename component_t> 
         component_t const &get(entity const &entity) const;
@@ -323,19 +1038,88 @@ namespace impl
         /// @tparam Include Types of included elements used to construct the view.
         /// @tparam Exclude Types of elements used to filter the view.
         /// @param toExclude The type list used to deduce Exclude variadic template argument.
-        /// @return A view on entities that are valid at the time of calling this member function and contain given included components and do not contain excluded ones at the time of calling this member function.
+        /// @return A lazy view on entities that contain given included components and do not contain excluded ones. 
+        /// The view is invalidated by structural changes, use basic_view::to_vector to get a copy.
         /// view<>() returns all the entities in the registry.
+        /// The non-const overload caches the matching entity groups, so the next views of the same types only walk the matching groups.
+        /// The const overload uses the cache if it exists, and tests every group otherwise.
+        template<typename... Include, typename... Exclude>
+        basic_view<registry, Include...> view(exclude<Exclude...> toExclude = exclude{});
+        /// @copydoc view
         template<typename... Include, typename... Exclude>
-        std::vector<entity> view(exclude<Exclude...> toExclude = exclude{}) const;
+        basic_view<registry const, Include...> view(exclude<Exclude...> toExclude = exclude{}) const;
 
         /// @brief Returns a view for the given elements.
         /// @tparam May Types of elements that entity may have used to construct the view.
         /// @tparam Exclude Types of elements used to filter the view.
         /// @param toExclude The type list used to deduce Exclude variadic template argument.
-        /// @return A view on entities that are valid at the time of calling this member function and contain given included components and do not contain excluded ones at the time of calling this member function.
+        /// @return A lazy view on entities that contain at least one of the given components and do not contain excluded ones.
+        /// The view is invalidated by structural changes, use basic_view::to_vector to get a copy.
         /// viewAny<>() returns none of the entities in the registry.
         template<typename... May, typename... Exclude>
-        std::vector<entity> viewAny(exclude<Exclude...> toExclude = exclude{}) const;
+        basic_view<registry const> viewAny(exclude<Exclude...> toExclude = exclude{}) const;
+
+        /// @brief Returns a view for a query built at runtime.
+        /// @param terms The query.
+        /// @return A lazy view on entities that match the query.
+        /// The view is invalidated by structural changes, use basic_view::to_vector to get a copy.
+        /// The non-const overload caches the groups matching the query in the registry, see query::id.
+        basic_view<registry> view(query const &terms);
+        /// @copydoc view(query const &)
+        basic_view<registry const> view(query const &terms) const;
+
+        /// @brief Count the entities that contain given included components and do not contain excluded ones.
+        /// Sums the sizes of the matching entity groups, using the cached groups of the query if view was called for the same types. No per entity work is done.
+        /// @tparam Include Types of included elements.
+        /// @tparam Exclude Types of elements used to filter the entities.
+        /// @param toExclude The type list used to deduce Exclude variadic template argument.
+        template<typename... Include, typename... Exclude>
+        std::size_t count(exclude<Exclude...> toExclude = exclude{}) const;
+        /// @brief Count the entities matching a query.
+        /// Sums the sizes of the matching entity groups, using the cached groups if view was called with the same query.
+        std::size_t count(query const &terms) const;
+
+        /// @brief Check whether any entity contains given included components and does not contain excluded ones.
+        /// Stops at the first non-empty matching entity group.
+        /// @tparam Include Types of included elements.
+        /// @tparam Exclude Types of elements used to filter the entities.
+        /// @param toExclude The type list used to deduce Exclude variadic template argument.
+        template<typename... Include, typename... Exclude>
+        bool any(exclude<Exclude...> toExclude = exclude{}) const;
+        /// @brief Check whether any entity matches a query.
+        bool any(query const &terms) const;
+
+        /// @brief Returns an owning group of the given components.
+        /// The first call creates the group and arranges the owned component arrays, next calls return the same group.
+        /// Keeping the group packed costs O(1) per emplace, remove and destroy of an owned component.
+        /// A component can be owned by only one group, and must use the ecs::sparse_set storage.
+        /// @tparam Owned Types of owned components.
+        /// @return A group of the entities that have all the owned components.
+        template<typename... Owned>
+        basic_group<registry, Owned...> group();
+
+        /// @brief Get the owning groups of the registry.
+        std::vector<impl::OwningGroup> const &getOwningGroups() const;
+
+        /// @brief Lay out the component arrays in entity group order.
+        /// Afterwards the components of every entity group are one contiguous run in each array, in the order of the group.
+        /// basic_view::each then walks the runs linearly instead of looking up every component, until the next structural change of an entity having one of the components.
+        /// Takes time proportional to the number of components. Arrays owned by a group or using other storage engines than ecs::sparse_set are left as is.
+        void arrange();
+
+        /// @brief Check whether the given components are laid out in entity group order.
+        /// @param components The components to check.
+        /// @return True if arrange was called for all the components, and no entity having one of them was created, destroyed, or got or lost a component since.
+        bool arranged(signature const &components) const;
+
+        /// @brief Make the results independent of threads and of the order component types were first used in, e.g. for lockstep multiplayer.
+        /// Views walk the entity groups in creation order, never the entities of a pivot array, whose choice depends on the component ids.
+        /// command_buffer::create returns provisional identifiers, and the real ones are given at playback in recording order.
+        /// basic_view::par_each already splits the work in chunks that only depend on the groups, use basic_view::par_each_commands for structural changes.
+        /// @param enabled True to enable the deterministic mode, false to disable it.
+        void set_deterministic(bool enabled = true);
+        /// @return True if the deterministic mode is enabled, false otherwise.
+        bool deterministic() const;
 
         /// @brief Copy an entity from the other registry.
         /// @param otherEntity The entity from @p other registry to copy.
@@ -344,6 +1128,28 @@ namespace impl
         /// Adds the entity and its components from the other registry to this registry.
         ecs::entity copy(entity const &otherEntity, registry const &other);
 
+        /// @brief Remove the entity groups that no entity uses anymore.
+        /// Entities are grouped by the set of components they have, and a group is kept when its last entity leaves it, so that views and cached queries stay cheap.
+        /// Call it after many component combinations were used once, e.g. at a level change. Invalidates the views.
+        void prune_groups();
+
+        /// @brief Get the memory used by the registry.
+        /// Takes time proportional to the number of sparse pages and groups. Does not allocate if @p stats were filled before.
+        /// @param stats The report to fill.
+        void memory_usage(registry_memory_stats &stats) const;
+        /// @copydoc memory_usage
+        registry_memory_stats memory_usage() const;
+
+        /// @brief Get the storage of a component type.
+        /// Gives access to the storage engine specific members (ecs::singleton_storage::value, ecs::shared_storage::each_value, etc.).
+        /// @tparam component_t The component type.
+        template <typename component_t>
+        impl::ComponentArray<component_t> &storage();
+        /// @copydoc storage
+        /// @throws std::out_of_range If the component was never used with the registry.
+        template <typename component_t>
+        impl::ComponentArray<component_t> const &storage() const;
+
         /// @brief Get the component manager.
         /// Use at your own risk.
         impl::ComponentManager const &getComponentManager() const;
@@ -355,87 +1161,847 @@ namespace impl
         impl::EntityManager const &getEntityManager() const;
         /// @copydoc getEntityManager
         impl::EntityManager &getEntityManager();
+
+        /// @brief Get the registry context.
+        /// The context stores registry-wide variables (input state, time step, etc.) with O(1) typed access.
+        /// It is copied along with the registry.
+        impl::ContextManager const &ctx() const;
+        /// @copydoc ctx
+        impl::ContextManager &ctx();
     };
-} // namespace ecs
 
-/*! \cond Doxygen_Suppress */
+    /// @brief A persistent list of entities, ordered by a key computed from their components.
+    /// Keep it across frames and call update once per frame. The previous order is repaired instead of sorted from scratch:
+    /// stale entities are dropped, the kept ones are insertion sorted, and the new ones are sorted and merged in.
+    /// A mostly sorted frame costs close to O(n). Ties are ordered by entity.
+    /// @code
+    /// ecs::sorted_view<float, Sprite> byDepth{[](Sprite const &sprite) { return sprite.depth; }};
+    /// byDepth.update(registry);
+    /// for(auto entity : byDepth) {}
+    /// @endcode
+    /// @tparam key_t The key type, compared with operator<.
+    /// @tparam Include Types of included elements, passed to the key extractor.
+    template<typename key_t, typename... Include>
+    class sorted_view
+    {
+        static_assert(sizeof...(Include) > 0, "A sorted view must include at least one component");
+    public:
+        /// @brief Computes the key of an entity from its components.
+        using key_extractor = std::function<key_t(Include const &...)>;
+        /// @brief Random access iterator over the sorted entities.
+        using iterator = typename std::vector<entity>::const_iterator;
+    private:
+        key_extractor mKey;
+        std::vector<std::pair<key_t, entity>> mOrder;
+        std::vector<entity> mEntities;
+        std::vector<bool> mMembers;
 
-inline ecs::impl::EntityManager::EntityManager()
-{
-    ECS_PROFILE;
-    mAvailableEntityIDs.reserve(1000);
-    mSignatures.reserve(1000);
-}
-inline ecs::entity ecs::impl::EntityManager::createEntity(signature signature)
-{
-    ECS_PROFILE;
-    entity entity = 0;
-    if(mAvailableEntityIDs.empty())
+        /// @brief Insertion sort, falling back to std::sort when the order is far from sorted.
+        void repair();
+    public:
+        /// @param key The key extractor.
+        explicit sorted_view(key_extractor key);
+
+        /// @brief Bring the order up to date with the registry.
+        /// Refreshes the keys of all the entities, so changed components are moved to their new place.
+        /// @param registry The registry to view. Use the same registry for every update.
+        void update(registry const &registry);
+
+        /// @brief Get the sorted entities, as of the last update.
+        std::vector<entity> const &entities() const;
+
+        /// @brief The first entity.
+        iterator begin() const;
+        /// @brief The end of the entities.
+        iterator end() const;
+
+        /// @brief Get the number of entities, as of the last update.
+        std::size_t size() const;
+
+        /// @return True if there are no entities, false otherwise.
+        bool empty() const;
+    };
+
+    /// @brief Records structural changes to apply them later, e.g. from the threads of basic_view::par_each.
+    /// Recording only reserves entity identifiers from the registry, which is thread safe, so every thread can fill its own buffer while the registry is iterated.
+    /// The components are moved into a linear arena owned by the buffer. playback merges the emplaces and removes of every entity in recording order,
+    /// e.g. a remove followed by an emplace of the same component replaces it, then applies the changes on one thread, in phases:
+    /// creates, removes grouped by component, emplaces grouped by component, destroys. Every entity changes its group at most once per phase.
+    /// Commands on entities that are not valid at playback (e.g. destroyed by another buffer) are dropped.
+    /// Within a phase the entities change groups in recording order, so a buffer filled in the same order always has the same result.
+    /// In a deterministic registry (see registry::set_deterministic) the created entities get their identifiers at playback.
+    /// @code
+    /// ecs::command_buffer commands{registry};
+    /// registry.view<Health>().each([&](ecs::entity e, Health const &health) { if(health.hp == 0) commands.destroy(e); });
+    /// commands.playback();
+    /// @endcode
+    class command_buffer
     {
-        entity = mNextID++;
-    } else {
-        entity = mAvailableEntityIDs.back();
-        mAvailableEntityIDs.pop_back();
-    }
-    ++mLivingEntitiesCount;
-    mEntityGroups[signature].emplace(entity, entity);
+    private:
+        /// @brief A recorded emplace or remove.
+        struct Command
+        {
+            entity target;
+            component_id component;
+            /// @brief The component to move in, nullptr for removes and once applied.
+            void *payload;
+            /// @brief Move the payload into the component array and destroy it. Erases the component for removes.
+            void (*apply)(impl::ComponentManager &, entity, void *);
+            /// @brief Destroy the payload without applying it, nullptr for removes.
+            void (*drop)(void *);
+            /// @brief False if the target is not valid or a later command undoes this one.
+            bool live;
+        };
+        /// @brief The merged commands of an entity.
+        struct Change
+        {
+            signature original;
+            signature current;
+            /// @brief The components of original that are removed, at least for a while.
+            signature erased;
+            /// @brief The components whose last emplace is kept.
+            signature added;
+        };
+        /// @brief A block of the arena.
+        struct Block
+        {
+            std::unique_ptr<unsigned char[]> data;
+            std::size_t size;
+            std::size_t used;
+        };
+        static constexpr std::size_t BLOCK_SIZE = 16 * 1024;
+        /// @brief Marks the identifiers created in a deterministic registry, the other bits index mCreated.
+        static constexpr entity PROVISIONAL = entity{1} << 31;
+
+        registry *mRegistry;
+        std::vector<Block> mBlocks;
+        std::size_t mBlock = 0;
+        std::vector<entity> mCreated;
+        std::vector<Command> mCommands;
+        std::vector<entity> mDestroyed;
+        std::vector<std::function<void(command_buffer const &)>> mThen;
+        std::vector<entity> mResolved;
+
+        /// @brief Get the created entity a provisional identifier stands for, once the entities are created.
+        entity created(entity const &entity) const;
+        /// @brief Bump allocate from the arena.
+        void *allocate(std::size_t size, std::size_t alignment);
+        /// @brief Destroy the payloads and rewind the arena.
+        void drop();
+        /// @brief Merge the commands of every entity in recording order, checking them, and mark the ones to apply.
+        /// Does not change the registry.
+        void merge(sparse_set<Change> &changes);
+    public:
+        /// @param registry The registry to reserve the entities from and to apply the changes to. Must outlive the buffer.
+        explicit command_buffer(registry &registry);
+        ~command_buffer();
+        command_buffer(command_buffer &&other) noexcept = default;
+        command_buffer(command_buffer const &) = delete;
+        command_buffer &operator=(command_buffer const &) = delete;
+
+        /// @brief Record the creation of an entity.
+        /// @return The identifier of the entity, valid after playback. More components can be recorded for it right away.
+        /// In a deterministic registry it is provisional: it can only be used with this buffer, see resolve.
+        entity create();
+        /// @brief Record the creation of an entity with components.
+        /// @param components The components to move in.
+        /// @return The identifier of the entity, valid after playback.
+        template <typename... Components_t>
+        entity create(Components_t &&...components);
 
-    mSignatures.emplace(entity, signature);
+        /// @brief Record the emplacement of a component.
+        /// @param entity The entity, valid at playback.
+        /// @param args The arguments to construct the component with, now.
+        template <typename component_t, class... Args>
+        void emplace(entity const &entity, Args &&...args);
 
-    return entity;
-}
-inline void ecs::impl::EntityManager::destroyEntity(entity const &entity)
-{
-    ECS_PROFILE;
-    ECS_ASSERT(valid(entity), "Invalid entity identifier");
-    --mLivingEntitiesCount;
-    mAvailableEntityIDs.push_back(entity);
+        /// @brief Record the removal of a component.
+        /// @param entity The entity, valid at playback.
+        template <typename component_t>
+        void remove(entity const &entity);
 
-    auto &group = mEntityGroups[getSignature(entity)];
-    group.erase(entity);
-    if(group.empty())
-        mEntityGroups.erase(getSignature(entity));
+        /// @brief Record the destruction of an entity. Destroying an entity more than once is fine.
+        /// @param entity The entity.
+        void destroy(entity const &entity);
 
-    mSignatures.erase(entity);
-}
-inline void ecs::impl::EntityManager::setSignature(entity const &entity, signature signature)
-{
-    ECS_PROFILE;
-    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+        /// @brief Record a function to call at the end of playback, once the created entities have their identifiers.
+        /// Use it to store the identifiers of the created entities, e.g. in a parent or as the target of an event, since provisional identifiers can only be resolved by this buffer.
+        /// @param func Called as func(command_buffer const &), in recording order, on the thread of the playback.
+        template <typename func_t>
+        void then(func_t &&func);
+
+        /// @brief Apply the recorded changes to the registry and clear the buffer. Not thread safe.
+        /// The commands are checked before anything is applied: if one is invalid (e.g. an emplace of a component the entity already has),
+        /// the created entities are given back, the buffer is cleared and the registry is left as it was.
+        void playback();
+
+        /// @brief Drop the recorded changes. The reserved entities are given back to the registry.
+        void clear();
+
+        /// @return True if nothing is recorded, false otherwise.
+        bool empty() const;
+
+        /// @brief Get the identifier an entity created before the last playback got.
+        /// @param entity An identifier returned by create. Identifiers that are not provisional are returned as is.
+        entity resolve(entity const &entity) const;
+    };
+
+    /// @brief Builds complete entities away from a registry, e.g. on a worker thread, to splice them into it at a sync point.
+    /// The identifiers are reserved from the target registry, which is thread safe, and the components are stored in a private registry,
+    /// so every thread can fill its own staging registry while the target is in use. Component types have the same identifiers everywhere.
+    /// commit appends every staged group and component array to the target at once, instead of moving the entities through the groups one emplace at a time.
+    /// The identifiers depend on the order the threads reserve them in, use command buffers in a deterministic registry (see registry::set_deterministic).
+    /// @code
+    /// std::vector<ecs::staging_registry> staging;
+    /// for(std::size_t i = 0; i < pool.size(); ++i)
+    ///     staging.emplace_back(registry);
+    /// pool.parallel_for(staging.size(), [&](std::size_t chunk) {
+    ///     for(int i = 0; i < 100'000; ++i)
+    ///         staging[chunk].create(Position{}, Velocity{});
+    /// });
+    /// for(auto &stage : staging)
+    ///     stage.commit();
+    /// @endcode
+    class staging_registry
+    {
+    private:
+        registry *mTarget;
+        registry mStaged;
+        std::vector<entity> mReleased;
+    public:
+        /// @param target The registry to reserve the entities from and to commit them to. Must outlive the staging registry.
+        explicit staging_registry(registry &target);
+        ~staging_registry() = default;
+        staging_registry(staging_registry &&other) noexcept = default;
+        staging_registry(staging_registry const &) = delete;
+        staging_registry &operator=(staging_registry const &) = delete;
+
+        /// @brief Create a staged entity.
+        /// @tparam Components_t Components (optional).
+        /// @return The identifier of the entity in the target registry, valid there after commit.
+        template <typename... Components_t>
+        entity create();
+        /// @brief Create a staged entity.
+        /// @param components The components to move in.
+        /// @return The identifier of the entity in the target registry, valid there after commit.
+        template <typename... Components_t>
+        entity create(Components_t &&...components);
+
+        /// @copydoc registry::emplace
+        template <typename component_t, class... Args>
+        void emplace(entity const &entity, Args &&...args);
+
+        /// @copydoc registry::remove
+        template <typename component_t>
+        void remove(entity const &entity);
+
+        /// @copydoc registry::get
+        template <typename component_t>
+        storage_reference<component_t> get(entity const &entity);
+        /// @copydoc registry::get
+        template <typename component_t>
+        component_t const &get(entity const &entity) const;
+
+        /// @copydoc registry::has
+        template <typename component_t>
+        bool has(entity const &entity) const;
+
+        /// @brief Check whether an entity is staged.
+        bool valid(entity const &entity) const;
+
+        /// @brief Destroy a staged entity. Its identifier is given back to the target at commit.
+        /// @param entity A staged entity.
+        void destroy(entity const &entity);
+
+        /// @brief Get the staged entities and components, e.g. to view them.
+        /// Entities must be created through the staging registry, not through this registry.
+        registry &staged();
+        /// @copydoc staged
+        registry const &staged() const;
+
+        /// @brief Get the number of staged entities.
+        std::size_t size() const;
+
+        /// @return True if nothing is staged, false otherwise.
+        bool empty() const;
+
+        /// @brief Splice the staged entities and their components into the target registry and clear the staging registry.
+        /// Every staged group and component array is appended to the target at once. Not thread safe against the target.
+        void commit();
+
+        /// @brief Drop the staged entities. Their identifiers are given back to the target registry.
+        void clear();
+    };
+
+    /// @brief A copy of the entities and of some component arrays of a registry, e.g. for a render thread while the next frame is simulated.
+    /// extract copies the entity groups and the selected arrays with their keys, reusing the memory of the previous extraction,
+    /// so the copy runs at memory bandwidth. The snapshot is read through the same view API as a registry, independently of the source.
+    /// @code
+    /// ecs::snapshot<Transform, Sprite> frame;
+    /// frame.extract(registry); // on the simulation thread, between frames
+    /// frame.view<Transform, Sprite>().each([](Transform const &transform, Sprite const &sprite) { draw(transform, sprite); });
+    /// @endcode
+    /// The entities keep their full signatures, so has and the excluded components of views see every component, but only the selected ones can be read.
+    /// @tparam Components The component types to copy. Only these can be included in views or read.
+    template<typename... Components>
+    class snapshot
+    {
+    private:
+        registry mRegistry;
+    public:
+        snapshot();
+
+        /// @brief Copy the entities and the selected components of a registry into the snapshot.
+        /// Not thread safe against changes of the source, or against readers of the snapshot.
+        /// @param source The registry to copy.
+        void extract(registry const &source);
+
+        /// @copydoc registry::view
+        /// @tparam Include Types among the components of the snapshot.
+        template<typename... Include, typename... Exclude>
+        basic_view<registry const, Include...> view(exclude<Exclude...> toExclude = exclude{}) const;
+
+        /// @copydoc registry::valid
+        bool valid(entity const &entity) const;
+
+        /// @copydoc registry::has
+        /// @tparam component_t Any component type, only the signature of the entity is read.
+        template <typename component_t>
+        bool has(entity const &entity) const;
+
+        /// @copydoc registry::get
+        /// @tparam component_t A type among the components of the snapshot.
+        template <typename component_t>
+        component_t const &get(entity const &entity) const;
 
-    auto &group = mEntityGroups[getSignature(entity)];
-    group.erase(entity);
-    if(group.empty())
-        mEntityGroups.erase(getSignature(entity));
+        /// @brief Get the number of entities, as of the last extraction.
+        std::size_t size() const;
+
+        /// @copydoc registry::storage
+        /// @tparam component_t A type among the components of the snapshot.
+        template <typename component_t>
+        impl::ComponentArray<component_t> const &storage() const;
 
-    mSignatures[entity] = signature;
+        /// @copydoc registry::memory_usage
+        registry_memory_stats memory_usage() const;
+    };
+} // namespace ecs
 
-    mEntityGroups[signature].emplace(entity, entity);
+/*! \cond Doxygen_Suppress */
 
+inline std::uint32_t ecs::query::nextID()
+{
+    return mNextID.fetch_add(1, std::memory_order_relaxed);
 }
-inline ecs::signature const &ecs::impl::EntityManager::getSignature(entity const &entity) const
+inline ecs::query &ecs::query::all(component_id id)
 {
-    ECS_ASSERT(valid(entity), "Invalid entity identifier");
-    
-    return mSignatures.get(entity);
+    mAll.set(id);
+    mID = NULL_QUERY;
+    return *this;
 }
-inline bool ecs::impl::EntityManager::valid(entity const &entity) const
+inline ecs::query &ecs::query::any(component_id id)
 {
-    return 1 <= entity && entity < mNextID && mSignatures.contains(entity);
+    mAny.set(id);
+    mAnyTerm = true;
+    mID = NULL_QUERY;
+    return *this;
 }
-inline std::size_t ecs::impl::EntityManager::size() const
+inline ecs::query &ecs::query::none(component_id id)
 {
-    return mLivingEntitiesCount;
+    mNone.set(id);
+    mID = NULL_QUERY;
+    return *this;
 }
-inline std::unordered_map<ecs::signature, ecs::sparse_set<ecs::entity>> const &ecs::impl::EntityManager::getEntityGroups() const
+inline ecs::query &ecs::query::optional(component_id id)
 {
-    return mEntityGroups;
-} 
-
-template <typename component_t>
-ecs::impl::ComponentArray<component_t>::ComponentArray() : sparse_set<component_t>(10, (PAGE_SIZE + sizeof(component_t) - 1) / sizeof(component_t)) {}
-template <typename component_t>
-inline void ecs::impl::ComponentArray<component_t>::onEntityDestroyed(entity const &entity)
+    mOptional.set(id);
+    mID = NULL_QUERY;
+    return *this;
+}
+template <typename... Component>
+inline ecs::query &ecs::query::all()
+{
+    (all(impl::ComponentManager::getComponentID<Component>()), ...);
+    return *this;
+}
+template <typename... Component>
+inline ecs::query &ecs::query::any()
+{
+    (any(impl::ComponentManager::getComponentID<Component>()), ...);
+    mAnyTerm = true;
+    mID = NULL_QUERY;
+    return *this;
+}
+template <typename... Component>
+inline ecs::query &ecs::query::none()
+{
+    (none(impl::ComponentManager::getComponentID<Component>()), ...);
+    return *this;
+}
+template <typename... Component>
+inline ecs::query &ecs::query::optional()
+{
+    (optional(impl::ComponentManager::getComponentID<Component>()), ...);
+    return *this;
+}
+inline ecs::signature const &ecs::query::all_mask() const { return mAll; }
+inline ecs::signature const &ecs::query::any_mask() const { return mAny; }
+inline ecs::signature const &ecs::query::none_mask() const { return mNone; }
+inline ecs::signature const &ecs::query::optional_mask() const { return mOptional; }
+inline bool ecs::query::matches(signature const &signature) const
+{
+    if((signature & mAll) != mAll)
+        return false;
+    if(mAnyTerm && (signature & mAny).none())
+        return false;
+    return (signature & mNone).none();
+}
+inline std::uint32_t ecs::query::id() const
+{
+    std::uint32_t id = mID.load(std::memory_order_relaxed);
+    if(id != NULL_QUERY)
+        return id;
+    std::uint32_t shared = NULL_QUERY;
+    {
+        std::lock_guard lock(mIDsMutex);
+        auto [it, inserted] = mIDs.try_emplace(key{mAll, mAny, mNone, mAnyTerm}, NULL_QUERY);
+        if(inserted)
+            it->second = nextID();
+        shared = it->second;
+    }
+    // threads using the same query at once agree on the first id assigned
+    if(mID.compare_exchange_strong(id, shared, std::memory_order_relaxed))
+        return shared;
+    return id;
+}
+inline bool ecs::query::key::operator==(key const &other) const
+{
+    return all == other.all && any == other.any && none == other.none && anyTerm == other.anyTerm;
+}
+inline std::size_t ecs::query::key_hash::operator()(key const &key) const
+{
+    std::hash<signature> hash;
+    std::size_t seed = hash(key.all);
+    seed ^= hash(key.any) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    seed ^= hash(key.none) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    return seed ^ key.anyTerm;
+}
+template <typename query_t>
+inline std::uint32_t ecs::impl::EntityManager::getQueryID()
+{
+    static const std::uint32_t id = query::nextID();
+    return id;
+}
+inline ecs::impl::EntityManager::EntityManager()
+{
+    ECS_PROFILE;
+    mAvailableEntityIDs.reserve(1000);
+    mRecords.reserve(1000);
+    mRecords.emplace_back(); // entity 0 is invalid
+}
+inline ecs::impl::group_index ecs::impl::EntityManager::getGroup(signature const &signature)
+{
+    ECS_PROFILE;
+    auto it = mGroupIndices.find(signature);
+    if(it != mGroupIndices.end())
+        return it->second;
+
+    group_index group = static_cast<group_index>(mGroups.size());
+    mGroups.emplace_back();
+    mGroupVersions.push_back(0);
+    mGroupSignatures.push_back(signature);
+    mGroupIndices.emplace(signature, group);
+    for(component_id id = 0; id < ComponentManager::getNextID(); ++id)
+    {
+        if(!signature.test(id))
+            continue;
+        if(id >= mComponentGroups.size())
+            mComponentGroups.resize(id + 1);
+        mComponentGroups[id].push_back(group);
+    }
+
+    // a new group is tested once against every registered query
+    for(QueryCache *query = mQueries.denseData(); query != mQueries.denseData() + mQueries.size(); ++query)
+    {
+        if(query->terms.matches(signature))
+            query->groups.push_back(group);
+    }
+    return group;
+}
+inline ecs::impl::EntityManager::EntityRecord &ecs::impl::EntityManager::getRecord(entity const &entity)
+{
+    return mRecords[entity - mFirstRecord];
+}
+inline ecs::impl::EntityManager::EntityRecord const &ecs::impl::EntityManager::getRecord(entity const &entity) const
+{
+    return mRecords[entity - mFirstRecord];
+}
+inline void ecs::impl::EntityManager::growRecords(entity const &entity)
+{
+    if(entity < mFirstRecord)
+    {
+        // adopted identifiers may come in any order
+        mRecords.insert(mRecords.begin(), mFirstRecord - entity, EntityRecord{});
+        mFirstRecord = entity;
+    }
+    else if(mRecords.size() <= entity - mFirstRecord)
+        mRecords.resize(entity - mFirstRecord + 1);
+}
+inline void ecs::impl::EntityManager::addToGroup(entity const &entity, group_index group)
+{
+    auto &entities = mGroups[group];
+    EntityRecord &record = getRecord(entity);
+    record.group = group;
+    record.index = static_cast<std::uint32_t>(entities.size());
+    entities.push_back(entity);
+    mGroupVersions[group] = ++mVersion;
+}
+inline void ecs::impl::EntityManager::removeFromGroup(entity const &entity)
+{
+    auto &record = getRecord(entity);
+    auto &entities = mGroups[record.group];
+    ecs::entity last = entities.back();
+    entities[record.index] = last;
+    getRecord(last).index = record.index;
+    entities.pop_back();
+    mGroupVersions[record.group] = ++mVersion;
+    record.group = NULL_GROUP;
+}
+inline ecs::entity ecs::impl::EntityManager::createEntity(signature signature)
+{
+    ECS_PROFILE;
+    entity entity = 0;
+    if(mAvailableEntityIDs.empty())
+    {
+        entity = mNextID.fetch_add(1, std::memory_order_relaxed);
+        // reserved identifiers may be created out of order
+        growRecords(entity);
+    } else {
+        entity = mAvailableEntityIDs.back();
+        mAvailableEntityIDs.pop_back();
+    }
+    ++mLivingEntitiesCount;
+    addToGroup(entity, getGroup(signature));
+
+    return entity;
+}
+inline ecs::entity ecs::impl::EntityManager::reserveEntity()
+{
+    return mNextID.fetch_add(1, std::memory_order_relaxed);
+}
+inline void ecs::impl::EntityManager::createReserved(entity const &entity, signature signature)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(1 <= entity && entity < mNextID.load(std::memory_order_relaxed) && !valid(entity), "Entity identifier is not reserved");
+    growRecords(entity);
+    ++mLivingEntitiesCount;
+    addToGroup(entity, getGroup(signature));
+}
+inline void ecs::impl::EntityManager::createReserved(std::vector<entity> const &entities, signature signature)
+{
+    ECS_PROFILE;
+    if(entities.empty())
+        return;
+    auto const [first, last] = std::minmax_element(entities.begin(), entities.end());
+    ECS_ASSERT(*last < mNextID.load(std::memory_order_relaxed), "Entity identifier is not reserved");
+    growRecords(*first);
+    growRecords(*last);
+
+    group_index const group = getGroup(signature);
+    auto &members = mGroups[group];
+    for(entity const &entity : entities)
+    {
+        ECS_ASSERT(1 <= entity && !valid(entity), "Entity identifier is not reserved");
+        EntityRecord &record = getRecord(entity);
+        record.group = group;
+        record.index = static_cast<std::uint32_t>(members.size());
+        members.push_back(entity);
+    }
+    mLivingEntitiesCount += static_cast<std::uint32_t>(entities.size());
+    mGroupVersions[group] = ++mVersion;
+}
+inline void ecs::impl::EntityManager::adoptEntity(entity const &entity, signature signature)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(1 <= entity && !valid(entity), "Entity identifier is already used");
+    if(mNextID.load(std::memory_order_relaxed) <= entity)
+        mNextID.store(entity + 1, std::memory_order_relaxed);
+    if(mLivingEntitiesCount == 0 && mAvailableEntityIDs.empty())
+    {
+        // no record is in use, start them at the adopted identifier instead of 0
+        mRecords.clear();
+        mFirstRecord = entity;
+    }
+    createReserved(entity, signature);
+}
+inline void ecs::impl::EntityManager::forgetEntities()
+{
+    ECS_PROFILE;
+    for(auto &group : mGroups)
+    {
+        for(entity const &entity : group)
+            getRecord(entity).group = NULL_GROUP;
+        group.clear();
+    }
+    mAvailableEntityIDs.clear();
+    mLivingEntitiesCount = 0;
+    mGroupVersions.assign(mGroupVersions.size(), ++mVersion);
+}
+inline void ecs::impl::EntityManager::releaseReserved(entity const &entity)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(1 <= entity && entity < mNextID.load(std::memory_order_relaxed) && !valid(entity), "Entity identifier is not reserved");
+    growRecords(entity);
+    mAvailableEntityIDs.push_back(entity);
+}
+inline void ecs::impl::EntityManager::destroyEntity(entity const &entity)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+    --mLivingEntitiesCount;
+    mAvailableEntityIDs.push_back(entity);
+    ++getRecord(entity).generation;
+
+    removeFromGroup(entity);
+}
+inline void ecs::impl::EntityManager::setSignature(entity const &entity, signature signature)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+
+    group_index group = getGroup(signature);
+    if(group == getRecord(entity).group)
+        return;
+
+    removeFromGroup(entity);
+    addToGroup(entity, group);
+}
+inline ecs::signature const &ecs::impl::EntityManager::getSignature(entity const &entity) const
+{
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+    
+    return mGroupSignatures[getRecord(entity).group];
+}
+inline std::uint32_t ecs::impl::EntityManager::getGeneration(entity const &entity) const
+{
+    return mFirstRecord <= entity && entity - mFirstRecord < mRecords.size() ? getRecord(entity).generation : 0;
+}
+inline ecs::impl::group_index ecs::impl::EntityManager::getGroupIndex(entity const &entity) const
+{
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+
+    return getRecord(entity).group;
+}
+inline std::vector<ecs::signature> const &ecs::impl::EntityManager::getGroupSignatures() const
+{
+    return mGroupSignatures;
+}
+inline std::unordered_map<ecs::signature, ecs::sparse_set<ecs::entity>> ecs::impl::EntityManager::getEntityGroups() const
+{
+    ECS_PROFILE;
+    std::unordered_map<signature, sparse_set<entity>> groups;
+    for(group_index group = 0; group < mGroups.size(); ++group)
+    {
+        if(mGroups[group].empty())
+            continue;
+        auto &entities = groups[mGroupSignatures[group]];
+        for(entity const &entity : mGroups[group])
+            entities.emplace(entity, entity);
+    }
+    return groups;
+}
+inline void ecs::impl::EntityManager::pruneGroups()
+{
+    ECS_PROFILE;
+    std::vector<group_index> moved(mGroups.size(), NULL_GROUP);
+    signature dropped;
+    group_index kept = 0;
+    for(group_index group = 0; group < mGroups.size(); ++group)
+    {
+        if(mGroups[group].empty())
+        {
+            dropped |= mGroupSignatures[group];
+            mGroupIndices.erase(mGroupSignatures[group]);
+            continue;
+        }
+        moved[group] = kept;
+        if(kept != group)
+        {
+            mGroups[kept] = std::move(mGroups[group]);
+            mGroupSignatures[kept] = mGroupSignatures[group];
+            mGroupVersions[kept] = mGroupVersions[group];
+        }
+        for(entity const &entity : mGroups[kept])
+            getRecord(entity).group = kept;
+        ++kept;
+    }
+    mGroups.resize(kept);
+    mGroups.shrink_to_fit();
+    mGroupSignatures.resize(kept);
+    mGroupSignatures.shrink_to_fit();
+    mGroupVersions.resize(kept);
+    mGroupVersions.shrink_to_fit();
+    // the version of a component is the latest of its groups, pass the changes of the dropped groups on to the kept ones
+    if(dropped.any())
+    {
+        ++mVersion;
+        for(group_index group = 0; group < kept; ++group)
+        {
+            if((mGroupSignatures[group] & dropped).any())
+                mGroupVersions[group] = mVersion;
+        }
+    }
+    for(auto &[signature, group] : mGroupIndices)
+        group = moved[group];
+
+    auto update = [&](std::vector<group_index> &groups) {
+        std::size_t size = 0;
+        for(group_index group : groups)
+        {
+            if(moved[group] != NULL_GROUP)
+                groups[size++] = moved[group];
+        }
+        groups.resize(size);
+    };
+    for(auto &groups : mComponentGroups)
+        update(groups);
+    for(QueryCache *query = mQueries.denseData(); query != mQueries.denseData() + mQueries.size(); ++query)
+        update(query->groups);
+}
+inline std::vector<std::vector<ecs::entity>> const &ecs::impl::EntityManager::getGroups() const
+{
+    return mGroups;
+}
+inline ecs::impl::QueryCache const &ecs::impl::EntityManager::registerQuery(std::uint32_t id, query const &terms)
+{
+    ECS_PROFILE;
+    if(mQueries.contains(id))
+        return mQueries.get(id);
+
+    QueryCache cache{terms, {}};
+    forEachMatchingGroup(terms, [&](group_index group) { cache.groups.push_back(group); return true; });
+    // keep the creation order of the groups, as if they were added one by one
+    std::sort(cache.groups.begin(), cache.groups.end());
+    mQueries.emplace(id, std::move(cache));
+    return mQueries.get(id);
+}
+inline std::vector<ecs::impl::group_index> const &ecs::impl::EntityManager::getComponentGroups(component_id id) const
+{
+    static const std::vector<group_index> empty;
+    return id < mComponentGroups.size() ? mComponentGroups[id] : empty;
+}
+inline std::vector<ecs::impl::group_index> const *ecs::impl::EntityManager::getRarestGroups(query const &terms) const
+{
+    std::vector<group_index> const *rarest = nullptr;
+    signature const &all = terms.all_mask();
+    for(component_id id = 0; id < ComponentManager::getNextID(); ++id)
+    {
+        if(!all.test(id))
+            continue;
+        auto const &groups = getComponentGroups(id);
+        if(!rarest || groups.size() < rarest->size())
+            rarest = &groups;
+    }
+    return rarest;
+}
+template <typename func_t>
+inline void ecs::impl::EntityManager::forEachMatchingGroup(query const &terms, func_t &&func) const
+{
+    ECS_PROFILE;
+    if(auto const *rarest = getRarestGroups(terms))
+    {
+        for(group_index group : *rarest)
+        {
+            if(terms.matches(mGroupSignatures[group]) && !func(group))
+                return;
+        }
+        return;
+    }
+    if(terms.any_mask().any())
+    {
+        // a group containing several any terms is visited with the first of them only
+        signature visited;
+        for(component_id id = 0; id < ComponentManager::getNextID(); ++id)
+        {
+            if(!terms.any_mask().test(id))
+                continue;
+            for(group_index group : getComponentGroups(id))
+            {
+                if((mGroupSignatures[group] & visited).none() && terms.matches(mGroupSignatures[group]) && !func(group))
+                    return;
+            }
+            visited.set(id);
+        }
+        return;
+    }
+    for(group_index group = 0; group < mGroupSignatures.size(); ++group)
+    {
+        if(terms.matches(mGroupSignatures[group]) && !func(group))
+            return;
+    }
+}
+inline ecs::impl::QueryCache const *ecs::impl::EntityManager::findQuery(std::uint32_t id) const
+{
+    auto index = mQueries.getDenseIndex(id);
+    if(index == mQueries.null)
+        return nullptr;
+    return mQueries.denseData() + index;
+}
+inline bool ecs::impl::EntityManager::valid(entity const &entity) const
+{
+    return 1 <= entity && mFirstRecord <= entity && entity - mFirstRecord < mRecords.size() && getRecord(entity).group != NULL_GROUP;
+}
+inline std::size_t ecs::impl::EntityManager::size() const
+{
+    return mLivingEntitiesCount;
+}
+inline std::uint64_t ecs::impl::EntityManager::version() const
+{
+    return mVersion;
+}
+inline std::uint64_t ecs::impl::EntityManager::version(component_id id) const
+{
+    std::uint64_t version = 0;
+    for(group_index group : getComponentGroups(id))
+        version = std::max(version, mGroupVersions[group]);
+    return version;
+}
+inline ecs::memory_stats ecs::impl::EntityManager::memoryUsage() const
+{
+    ECS_PROFILE;
+    constexpr std::size_t nodeBytes = sizeof(std::pair<signature const, group_index>) + sizeof(void *) + sizeof(std::size_t);
+    memory_stats stats;
+    stats.elements = mLivingEntitiesCount;
+    stats.denseBytes = mRecords.capacity() * sizeof(EntityRecord);
+    stats.keyBytes = mAvailableEntityIDs.capacity() * sizeof(entity);
+    stats.sparseBytes = 
+        mGroupSignatures.capacity() * sizeof(signature) +
+        mGroupVersions.capacity() * sizeof(std::uint64_t) + 
+        mGroups.capacity() * sizeof(std::vector<entity>) + 
+        mGroupIndices.bucket_count() * sizeof(void *) + mGroupIndices.size() * nodeBytes + 
+        mComponentGroups.capacity() * sizeof(std::vector<group_index>);
+    for(auto const &groups : mComponentGroups)
+        stats.sparseBytes += groups.capacity() * sizeof(group_index);
+    stats.wastedBytes = 
+        (mRecords.capacity() - mLivingEntitiesCount) * sizeof(EntityRecord) + 
+        (mAvailableEntityIDs.capacity() - mAvailableEntityIDs.size()) * sizeof(entity);
+    for(QueryCache const *query = mQueries.denseData(); query != mQueries.denseData() + mQueries.size(); ++query)
+        stats.sparseBytes += sizeof(QueryCache) + query->groups.capacity() * sizeof(group_index);
+    return stats;
+}
+
+template <typename component_t>
+ecs::impl::ComponentArray<component_t>::ComponentArray() : storage_type(makeStorage()) {}
+template <typename component_t>
+inline typename ecs::impl::ComponentArray<component_t>::storage_type ecs::impl::ComponentArray<component_t>::makeStorage()
+{
+    if constexpr(std::is_same_v<storage_type, sparse_set<component_t>>)
+        return storage_type(10, (PAGE_SIZE + sizeof(component_t) - 1) / sizeof(component_t));
+    else
+        return storage_type{};
+}
+template <typename component_t>
+inline void ecs::impl::ComponentArray<component_t>::onEntityDestroyed(entity const &entity)
 {
     ECS_PROFILE;
     if(this->contains(entity))
@@ -448,7 +2014,12 @@ inline void ecs::impl::ComponentArray<component_t>::copyEntityFrom(impl::ICompon
     ECS_ASSERT(other, "Internal logic error");
     ecs::impl::ComponentArray<component_t> const *otherArray = static_cast<ecs::impl::ComponentArray<component_t> const *>(other);
     ECS_ASSERT(this->contains(to) && otherArray->contains(from), "Internal logic error");
-    this->get(to) = otherArray->get(from);
+    if constexpr(hasCopy<storage_type>)
+        this->copy(to, *otherArray, from);
+    else if constexpr(hasReplace<storage_type>)
+        this->replace(to, otherArray->get(from));
+    else
+        this->get(to) = otherArray->get(from);
 }
 template <typename component_t>
 inline void ecs::impl::ComponentArray<component_t>::addEntity(entity const &entity)
@@ -469,6 +2040,81 @@ inline std::unique_ptr<ecs::impl::IComponentArray> ecs::impl::ComponentArray<com
     ECS_PROFILE;
     return std::unique_ptr<ecs::impl::IComponentArray>{new ecs::impl::ComponentArray<component_t>{*this}};
 }
+template <typename component_t>
+inline void ecs::impl::ComponentArray<component_t>::assign(impl::IComponentArray const *other)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(other, "Internal logic error");
+    static_cast<storage_type &>(*this) = static_cast<storage_type const &>(*static_cast<ecs::impl::ComponentArray<component_t> const *>(other));
+}
+template <typename component_t>
+inline ecs::memory_stats ecs::impl::ComponentArray<component_t>::memoryUsage() const
+{
+    return this->memory_usage();
+}
+template <typename component_t>
+inline ecs::entity ecs::impl::ComponentArray<component_t>::entityAt(std::size_t index) const
+{
+    ECS_ASSERT(index < this->size(), "Dense position out of range");
+    return this->sparse()[index];
+}
+template <typename component_t>
+inline std::vector<std::size_t> const &ecs::impl::ComponentArray<component_t>::entities() const
+{
+    return this->sparse();
+}
+template <typename component_t>
+inline bool ecs::impl::ComponentArray<component_t>::swappable() const
+{
+    return std::is_same_v<storage_type, sparse_set<component_t>>;
+}
+template <typename component_t>
+inline std::size_t ecs::impl::ComponentArray<component_t>::indexOf([[maybe_unused]] entity const &entity) const
+{
+    if constexpr(std::is_same_v<storage_type, sparse_set<component_t>>)
+    {
+        return this->getDenseIndex(entity);
+    }
+    else
+    {
+        ECS_ASSERT(false, "Dense positions are only supported by sparse_set storages");
+        return 0;
+    }
+}
+template <typename component_t>
+inline void ecs::impl::ComponentArray<component_t>::swapEntities([[maybe_unused]] entity const &lhs, [[maybe_unused]] entity const &rhs)
+{
+    if constexpr(std::is_same_v<storage_type, sparse_set<component_t>>)
+        this->swapDense(lhs, rhs);
+    else
+        ECS_ASSERT(false, "Dense positions are only supported by sparse_set storages");
+}
+template <typename component_t>
+inline void ecs::impl::ComponentArray<component_t>::appendFrom(impl::IComponentArray *other)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(other, "Internal logic error");
+    storage_type &source = *static_cast<ecs::impl::ComponentArray<component_t> *>(other);
+    if constexpr(std::is_same_v<storage_type, sparse_set<component_t>>)
+        this->append(std::move(source));
+    else
+    {
+        for(std::size_t const &entity : source.sparse())
+        {
+            // shared storages intern the value, double buffered ones keep the next value too, others take it over
+            if constexpr(hasReplace<storage_type>)
+                this->emplace(entity, std::as_const(source).get(entity));
+            else if constexpr(hasCopy<storage_type>)
+            {
+                this->emplace(entity, std::as_const(source).get(entity));
+                this->copy(entity, source, entity);
+            }
+            else
+                this->emplace(entity, std::move(source.get(entity)));
+        }
+        source.clear();
+    }
+}
 
 template <typename component_t>
 inline void ecs::impl::ComponentManager::registerComponent(std::unique_ptr<ecs::impl::IComponentArray> &&array)
@@ -481,8 +2127,8 @@ inline void ecs::impl::ComponentManager::registerComponent(std::unique_ptr<ecs::
 template <typename component_t>
 inline ecs::component_id ecs::impl::ComponentManager::getComponentID()
 {
-    ECS_ASSERT(mNextID < MAX_COMPONENTS, "Too many components registered");
-    static const component_id id = mNextID++;
+    static const component_id id = mNextID.fetch_add(1, std::memory_order_relaxed);
+    ECS_ASSERT(id < MAX_COMPONENTS, "Too many components registered");
     return id;
 }
 template <typename component_t>
@@ -505,9 +2151,25 @@ inline ecs::impl::ComponentArray<component_t> const *ecs::impl::ComponentManager
         return nullptr;
     return static_cast<impl::ComponentArray<component_t> const *>(mComponentArrays.get(id).get());
 }
+template <typename component_t>
+inline ecs::impl::ComponentArray<component_t> *ecs::impl::ComponentManager::findComponentArray()
+{
+    auto index = mComponentArrays.getDenseIndex(getComponentID<component_t>());
+    if(index == mComponentArrays.null)
+        return nullptr;
+    return static_cast<impl::ComponentArray<component_t> *>(mComponentArrays.denseData()[index].get());
+}
+template <typename component_t>
+inline ecs::impl::ComponentArray<component_t> const *ecs::impl::ComponentManager::findComponentArray() const
+{
+    auto index = mComponentArrays.getDenseIndex(getComponentID<component_t>());
+    if(index == mComponentArrays.null)
+        return nullptr;
+    return static_cast<impl::ComponentArray<component_t> const *>(mComponentArrays.denseData()[index].get());
+}
 inline std::size_t ecs::impl::ComponentManager::getNextID()
 {
-    return mNextID;
+    return std::min<std::size_t>(mNextID.load(std::memory_order_relaxed), MAX_COMPONENTS);
 }
 inline ecs::impl::ComponentManager::ComponentManager(impl::ComponentManager const &other)
 {
@@ -516,9 +2178,24 @@ inline ecs::impl::ComponentManager::ComponentManager(impl::ComponentManager cons
 inline ecs::impl::ComponentManager &ecs::impl::ComponentManager::operator=(impl::ComponentManager const &other)
 {
     ECS_PROFILE;
+    if(this == &other)
+        return *this;
+
+    // drop the arrays the other manager doesent have
+    for(std::size_t i = mComponentArrays.size(); i-- > 0;)
+    {
+        auto id = mComponentArrays.sparse()[i];
+        if(!other.mComponentArrays.contains(id))
+            mComponentArrays.erase(id);
+    }
+
+    // copy into the existing arrays in place, so that repeated copies do not allocate
     for(auto [id, ptr] : other.mComponentArrays)
     {
-        mComponentArrays.emplace(id, ptr->clone());
+        if(mComponentArrays.contains(id))
+            mComponentArrays.get(id)->assign(ptr.get());
+        else
+            mComponentArrays.emplace(id, ptr->clone());
     }
 
     return *this;
@@ -539,26 +2216,119 @@ inline ecs::sparse_set<std::unique_ptr<ecs::impl::IComponentArray>> const &ecs::
     return mComponentArrays;
 }
 
-template <typename component_t>
-inline bool ecs::registry::has(entity const &entity) const
-{ 
-    ECS_PROFILE;
-    ECS_ASSERT(valid(entity), "Invalid entity identifier");
-    
-    mComponentManager.registerComponent<component_t>();
-    return mEntityManager.getSignature(entity).test(impl::ComponentManager::getComponentID<component_t>()); 
+template <typename value_t>
+template <class... Args>
+inline ecs::impl::ContextVariable<value_t>::ContextVariable(Args&&... args) : value(construct(std::forward<Args>(args)...)) {}
+template <typename value_t>
+template <class... Args>
+inline value_t ecs::impl::ContextVariable<value_t>::construct(Args&&... args)
+{
+    if constexpr(impl::isBraceInitialized<value_t, Args...>)
+        return value_t{std::forward<Args>(args)...};
+    else
+        return value_t(std::forward<Args>(args)...);
 }
-template <typename component_t>
-inline component_t &ecs::registry::get(entity const &entity) 
+template <typename value_t>
+inline std::unique_ptr<ecs::impl::IContextVariable> ecs::impl::ContextVariable<value_t>::clone() const
 {
     ECS_PROFILE;
-    ECS_ASSERT(valid(entity), "Invalid entity identifier");
-    ECS_ASSERT(has<component_t>(entity), "Component to get is not added");
-    
-    return mComponentManager.getComponentArray<component_t>()->get(entity);
+    return std::unique_ptr<ecs::impl::IContextVariable>{new ecs::impl::ContextVariable<value_t>{value}};
 }
+template <typename value_t>
+inline std::uint32_t ecs::impl::ContextManager::getContextID()
+{
+    static const std::uint32_t id = mNextID.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+inline ecs::impl::ContextManager::ContextManager(impl::ContextManager const &other)
+{
+    this->operator=(other);
+}
+inline ecs::impl::ContextManager &ecs::impl::ContextManager::operator=(impl::ContextManager const &other)
+{
+    ECS_PROFILE;
+    if(this == &other)
+        return *this;
+    mVariables.clear();
+    for(auto [id, ptr] : other.mVariables)
+    {
+        mVariables.emplace(id, ptr->clone());
+    }
+
+    return *this;
+}
+template <typename value_t, class... Args>
+inline value_t &ecs::impl::ContextManager::emplace(Args&&... args)
+{
+    ECS_PROFILE;
+    auto id = getContextID<value_t>();
+    auto variable = std::make_unique<impl::ContextVariable<value_t>>(std::forward<Args>(args)...);
+    value_t &value = variable->value;
+    if(mVariables.contains(id))
+        mVariables.get(id) = std::move(variable);
+    else
+        mVariables.emplace(id, std::move(variable));
+    return value;
+}
+template <typename value_t>
+inline value_t &ecs::impl::ContextManager::get()
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains<value_t>(), "Context variable to get is not present");
+    return static_cast<impl::ContextVariable<value_t> *>(mVariables.get(getContextID<value_t>()).get())->value;
+}
+template <typename value_t>
+inline value_t const &ecs::impl::ContextManager::get() const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains<value_t>(), "Context variable to get is not present");
+    return static_cast<impl::ContextVariable<value_t> const *>(mVariables.get(getContextID<value_t>()).get())->value;
+}
+template <typename value_t>
+inline value_t *ecs::impl::ContextManager::find()
+{
+    ECS_PROFILE;
+    auto index = mVariables.getDenseIndex(getContextID<value_t>());
+    if(index == mVariables.null)
+        return nullptr;
+    return &static_cast<impl::ContextVariable<value_t> *>(mVariables.denseData()[index].get())->value;
+}
+template <typename value_t>
+inline value_t const *ecs::impl::ContextManager::find() const
+{
+    ECS_PROFILE;
+    auto index = mVariables.getDenseIndex(getContextID<value_t>());
+    if(index == mVariables.null)
+        return nullptr;
+    return &static_cast<impl::ContextVariable<value_t> const *>(mVariables.denseData()[index].get())->value;
+}
+template <typename value_t>
+inline bool ecs::impl::ContextManager::contains() const
+{
+    return mVariables.contains(getContextID<value_t>());
+}
+template <typename value_t>
+inline void ecs::impl::ContextManager::erase()
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains<value_t>(), "Context variable to erase is not present");
+    mVariables.erase(getContextID<value_t>());
+}
+inline std::size_t ecs::impl::ContextManager::size() const
+{
+    return mVariables.size();
+}
+
 template <typename component_t>
-inline component_t const &ecs::registry::get(entity const &entity) const
+inline bool ecs::registry::has(entity const &entity) const
+{ 
+    ECS_PROFILE;
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+    
+    return mEntityManager.getSignature(entity).test(impl::ComponentManager::getComponentID<component_t>()); 
+}
+template <typename component_t>
+inline ecs::storage_reference<component_t> ecs::registry::get(entity const &entity) 
 {
     ECS_PROFILE;
     ECS_ASSERT(valid(entity), "Invalid entity identifier");
@@ -566,6 +2336,15 @@ inline component_t const &ecs::registry::get(entity const &entity) const
     
     return mComponentManager.getComponentArray<component_t>()->get(entity);
 }
+template <typename component_t>
+inline component_t const &ecs::registry::get(entity const &entity) const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(valid(entity), "Invalid entity identifier");
+    ECS_ASSERT(has<component_t>(entity), "Component to get is not added");
+    
+    return std::as_const(mComponentManager).getComponentArray<component_t>()->get(entity);
+}
 template <typename... Components_t>
 inline ecs::entity ecs::registry::create()
 {
@@ -597,6 +2376,8 @@ inline void ecs::registry::remove(entity const &entity)
     ECS_ASSERT(valid(entity), "Invalid entity identifier");
     ECS_ASSERT(has<component_t>(entity), "Component to remove is not added");
     
+    if(!mOwningGroups.empty())
+        leaveOwningGroups(entity, signature{}.set(impl::ComponentManager::getComponentID<component_t>()));
     mEntityManager.setSignature(entity, signature{mEntityManager.getSignature(entity)}.set(impl::ComponentManager::getComponentID<component_t>(), false));
     mComponentManager.getComponentArray<component_t>()->erase(entity);
 }
@@ -607,8 +2388,11 @@ inline void ecs::registry::emplace(entity const &entity, Args&&... args)
     ECS_ASSERT(valid(entity), "Invalid entity identifier");
     ECS_ASSERT(!has<component_t>(entity), "Component to emplace already added");
 
+    mComponentManager.registerComponent<component_t>();
     mComponentManager.getComponentArray<component_t>()->emplace(entity, std::forward<Args>(args)...);
     mEntityManager.setSignature(entity, signature{mEntityManager.getSignature(entity)}.set(impl::ComponentManager::getComponentID<component_t>(), true));
+    if(!mOwningGroups.empty())
+        enterOwningGroups(entity, signature{}.set(impl::ComponentManager::getComponentID<component_t>()));
 }
 inline ecs::registry::registry(registry const &other)
 {
@@ -623,6 +2407,11 @@ inline ecs::registry &ecs::registry::operator=(registry const &other)
     ECS_PROFILE;
     mEntityManager = other.mEntityManager;
     mComponentManager = other.mComponentManager;
+    mContext = other.mContext;
+    mOwningGroups = other.mOwningGroups;
+    mArrangedComponents = other.mArrangedComponents;
+    mArrangedVersion = other.mArrangedVersion;
+    mDeterministic = other.mDeterministic;
     return *this;
 }
 inline ecs::registry &ecs::registry::operator=(registry &&other) noexcept
@@ -630,6 +2419,11 @@ inline ecs::registry &ecs::registry::operator=(registry &&other) noexcept
     ECS_PROFILE;
     std::swap(mEntityManager, other.mEntityManager);
     std::swap(mComponentManager, other.mComponentManager);
+    std::swap(mContext, other.mContext);
+    std::swap(mOwningGroups, other.mOwningGroups);
+    std::swap(mArrangedComponents, other.mArrangedComponents);
+    std::swap(mArrangedVersion, other.mArrangedVersion);
+    std::swap(mDeterministic, other.mDeterministic);
     return *this;
 }
 inline bool ecs::registry::valid(entity const &entity) const
@@ -641,6 +2435,8 @@ inline void ecs::registry::destroy(ecs::entity const &entity)
     ECS_PROFILE;
     ECS_ASSERT(valid(entity), "Invalid entity identifier");
 
+    if(!mOwningGroups.empty())
+        leaveOwningGroups(entity, mEntityManager.getSignature(entity));
     mEntityManager.destroyEntity(entity);
     mComponentManager.entityDestroyed(entity);
 }
@@ -653,7 +2449,7 @@ inline bool ecs::registry::empty(entity const &entity) const
 inline void ecs::registry::clear() 
 {
     ECS_PROFILE;
-    for(entity const &e : view<>())
+    for(entity const &e : view<>().to_vector())
         destroy(e);
 }
 inline std::size_t ecs::registry::size(entity const &entity) const 
@@ -691,52 +2487,1160 @@ inline ecs::entity ecs::registry::copy(entity const &otherEntity, registry const
 
         mComponentManager.getComponentArrays().get(id)->copyEntityFrom(other.mComponentManager.getComponentArrays().get(id).get(), entity, otherEntity);
     }
+    if(!mOwningGroups.empty())
+        enterOwningGroups(entity, signature);
 
     return entity;
 }
 template <typename... Include, typename... Exclude>
-inline std::vector<ecs::entity> ecs::registry::view(exclude<Exclude...>) const
+inline ecs::basic_view<ecs::registry, Include...> ecs::registry::view(exclude<Exclude...>)
 {
     ECS_PROFILE;
-    ecs::signature required;
-    ecs::signature excluded;
-    (required.set(impl::ComponentManager::getComponentID<Include>()), ...);
-    (excluded.set(impl::ComponentManager::getComponentID<Exclude>()), ...);
+    query terms;
+    terms.all<Include...>();
+    terms.none<Exclude...>();
+    std::uint32_t id = impl::EntityManager::getQueryID<impl::type_list<std::false_type, impl::type_list<Include...>, impl::type_list<Exclude...>>>();
+    if(!mQueriesLocked)
+        mEntityManager.registerQuery(id, terms);
+
+    return {*this, terms, id};
+}
+template <typename... Include, typename... Exclude>
+inline ecs::basic_view<ecs::registry const, Include...> ecs::registry::view(exclude<Exclude...>) const
+{
+    ECS_PROFILE;
+    query terms;
+    terms.all<Include...>();
+    terms.none<Exclude...>();
 
-    std::vector<ecs::entity> result;
-    result.reserve(10);
+    return {*this, terms, impl::EntityManager::getQueryID<impl::type_list<std::false_type, impl::type_list<Include...>, impl::type_list<Exclude...>>>()};
+}
+template <typename... May, typename... Exclude>
+inline ecs::basic_view<ecs::registry const> ecs::registry::viewAny(exclude<Exclude...>) const 
+{
+    ECS_PROFILE;
+    query terms;
+    terms.any<May...>();
+    terms.none<Exclude...>();
 
-    for(auto const &[signature, group] : mEntityManager.getEntityGroups())
+    return {*this, terms, impl::EntityManager::getQueryID<impl::type_list<std::true_type, impl::type_list<May...>, impl::type_list<Exclude...>>>()};
+}
+inline ecs::basic_view<ecs::registry> ecs::registry::view(query const &terms)
+{
+    ECS_PROFILE;
+    if(!mQueriesLocked)
+        mEntityManager.registerQuery(terms.id(), terms);
+    return {*this, terms, terms.id()};
+}
+inline ecs::basic_view<ecs::registry const> ecs::registry::view(query const &terms) const
+{
+    ECS_PROFILE;
+    return {*this, terms, terms.id()};
+}
+inline std::size_t ecs::registry::countMatching(query const &terms, std::uint32_t id, bool stopAtFirst) const
+{
+    ECS_PROFILE;
+    std::size_t count = 0;
+    auto const &groups = mEntityManager.getGroups();
+    if(impl::QueryCache const *cache = mEntityManager.findQuery(id))
     {
-        if((signature & required) == required && (signature & excluded).none())
-            result.insert(result.end(), group.dense().begin(), group.dense().end());
+        for(impl::group_index group : cache->groups)
+        {
+            count += groups[group].size();
+            if(stopAtFirst && count)
+                break;
+        }
+        return count;
     }
-
-    return result;
+    mEntityManager.forEachMatchingGroup(terms, [&](impl::group_index group) {
+        count += groups[group].size();
+        return !(stopAtFirst && count);
+    });
+    return count;
 }
-template <typename... May, typename... Exclude>
-inline std::vector<ecs::entity> ecs::registry::viewAny(exclude<Exclude...> toExclude) const 
+template <typename... Include, typename... Exclude>
+inline std::size_t ecs::registry::count(exclude<Exclude...>) const
+{
+    query terms;
+    terms.all<Include...>();
+    terms.none<Exclude...>();
+    return countMatching(terms, impl::EntityManager::getQueryID<impl::type_list<std::false_type, impl::type_list<Include...>, impl::type_list<Exclude...>>>(), false);
+}
+inline std::size_t ecs::registry::count(query const &terms) const
+{
+    return countMatching(terms, terms.id(), false);
+}
+template <typename... Include, typename... Exclude>
+inline bool ecs::registry::any(exclude<Exclude...>) const
+{
+    query terms;
+    terms.all<Include...>();
+    terms.none<Exclude...>();
+    return countMatching(terms, impl::EntityManager::getQueryID<impl::type_list<std::false_type, impl::type_list<Include...>, impl::type_list<Exclude...>>>(), true) != 0;
+}
+inline bool ecs::registry::any(query const &terms) const
+{
+    return countMatching(terms, terms.id(), true) != 0;
+}
+template <typename... Owned>
+inline ecs::basic_group<ecs::registry, Owned...> ecs::registry::group()
 {
     ECS_PROFILE;
-    ecs::signature required;
-    ecs::signature excluded;
-    (required.set(impl::ComponentManager::getComponentID<May>()), ...);
-    (excluded.set(impl::ComponentManager::getComponentID<Exclude>()), ...);
+    static_assert(sizeof...(Owned) > 0, "A group must own at least one component");
+    static_assert((std::is_same_v<typename impl::ComponentArray<Owned>::storage_type, sparse_set<Owned>> && ...), "Owned components must use the sparse_set storage");
+
+    (mComponentManager.registerComponent<Owned>(), ...);
+    signature owned;
+    (owned.set(impl::ComponentManager::getComponentID<Owned>()), ...);
+    for(std::size_t i = 0; i < mOwningGroups.size(); ++i)
+    {
+        if(mOwningGroups[i].owned == owned)
+            return {*this, i};
+        ECS_ASSERT((mOwningGroups[i].owned & owned).none(), "Component is already owned by another group");
+    }
 
-    std::vector<ecs::entity> result;
-    result.reserve(10);
+    mOwningGroups.push_back({owned, {impl::ComponentManager::getComponentID<Owned>()...}, 0});
+    mArrangedComponents &= ~owned;
+    for(entity const &e : std::as_const(*this).view<Owned...>().to_vector())
+        enterOwningGroup(mOwningGroups.back(), e);
+    return {*this, mOwningGroups.size() - 1};
+}
+inline std::vector<ecs::impl::OwningGroup> const &ecs::registry::getOwningGroups() const
+{
+    return mOwningGroups;
+}
+inline void ecs::registry::arrange()
+{
+    ECS_PROFILE;
+    signature owned;
+    for(auto const &group : mOwningGroups)
+        owned |= group.owned;
+
+    auto const &groups = mEntityManager.getGroups();
+    auto const &signatures = mEntityManager.getGroupSignatures();
+    auto &arrays = mComponentManager.getComponentArrays();
+    mArrangedComponents.reset();
+    for(std::size_t i = 0; i < arrays.size(); ++i)
+    {
+        component_id id = static_cast<component_id>(arrays.sparse()[i]);
+        impl::IComponentArray *array = arrays.denseData()[i].get();
+        if(owned.test(id) || !array->swappable())
+            continue;
 
-    for(auto const &[signature, group] : mEntityManager.getEntityGroups())
+        // every entity having the component is in exactly one group with the component
+        std::size_t position = 0;
+        for(impl::group_index group = 0; group < groups.size(); ++group)
+        {
+            if(!signatures[group].test(id))
+                continue;
+            for(entity e : groups[group])
+                array->swapEntities(e, array->entityAt(position++));
+        }
+        mArrangedComponents.set(id);
+    }
+    mArrangedVersion = mEntityManager.version();
+}
+inline bool ecs::registry::arranged(signature const &components) const
+{
+    if((components & mArrangedComponents) != components)
+        return false;
+    // changes to the groups without the components leave their arrays untouched
+    for(component_id id = 0; id < impl::ComponentManager::getNextID(); ++id)
+    {
+        if(components.test(id) && mEntityManager.version(id) > mArrangedVersion)
+            return false;
+    }
+    return true;
+}
+inline void ecs::registry::set_deterministic(bool enabled)
+{
+    mDeterministic = enabled;
+}
+inline bool ecs::registry::deterministic() const
+{
+    return mDeterministic;
+}
+inline void ecs::registry::enterOwningGroup(impl::OwningGroup &group, entity const &entity)
+{
+    auto &arrays = mComponentManager.getComponentArrays();
+    if(arrays.get(group.components.front())->indexOf(entity) < group.size)
+        return;
+    for(component_id id : group.components)
     {
-        if((signature & required).any() && (signature & excluded).none())
-            result.insert(result.end(), group.dense().begin(), group.dense().end());
+        auto &array = arrays.get(id);
+        array->swapEntities(entity, array->entityAt(group.size));
+    }
+    ++group.size;
+}
+inline void ecs::registry::leaveOwningGroup(impl::OwningGroup &group, entity const &entity)
+{
+    auto &arrays = mComponentManager.getComponentArrays();
+    if(arrays.get(group.components.front())->indexOf(entity) >= group.size)
+        return;
+    --group.size;
+    for(component_id id : group.components)
+    {
+        auto &array = arrays.get(id);
+        array->swapEntities(entity, array->entityAt(group.size));
+    }
+}
+inline void ecs::registry::enterOwningGroups(entity const &entity, signature const &changed)
+{
+    ECS_PROFILE;
+    signature const &current = mEntityManager.getSignature(entity);
+    for(auto &group : mOwningGroups)
+    {
+        if((group.owned & changed).any() && (current & group.owned) == group.owned)
+            enterOwningGroup(group, entity);
+    }
+}
+inline void ecs::registry::leaveOwningGroups(entity const &entity, signature const &changed)
+{
+    ECS_PROFILE;
+    signature const &current = mEntityManager.getSignature(entity);
+    for(auto &group : mOwningGroups)
+    {
+        if((group.owned & changed).any() && (current & group.owned) == group.owned)
+            leaveOwningGroup(group, entity);
+    }
+}
+inline std::size_t ecs::registry_memory_stats::total() const
+{
+    std::size_t total = entities.total();
+    for(auto const &[id, stats] : components)
+        total += stats.total();
+    for(auto const &[signature, stats] : groups)
+        total += stats.total();
+    return total;
+}
+inline void ecs::registry::memory_usage(registry_memory_stats &stats) const
+{
+    ECS_PROFILE;
+    stats.components.clear();
+    for(auto [id, array] : mComponentManager.getComponentArrays())
+        stats.components.emplace_back(static_cast<component_id>(id), array->memoryUsage());
+
+    stats.groups.clear();
+    auto const &groups = mEntityManager.getGroups();
+    auto const &signatures = mEntityManager.getGroupSignatures();
+    for(impl::group_index group = 0; group < groups.size(); ++group)
+    {
+        memory_stats groupStats;
+        groupStats.elements = groups[group].size();
+        groupStats.denseBytes = groups[group].capacity() * sizeof(entity);
+        groupStats.wastedBytes = (groups[group].capacity() - groups[group].size()) * sizeof(entity);
+        stats.groups.emplace_back(signatures[group], groupStats);
     }
 
-    return result;
+    stats.entities = mEntityManager.memoryUsage();
+}
+inline void ecs::registry::prune_groups()
+{
+    mEntityManager.pruneGroups();
+}
+inline ecs::registry_memory_stats ecs::registry::memory_usage() const
+{
+    registry_memory_stats stats;
+    memory_usage(stats);
+    return stats;
+}
+template <typename component_t>
+inline ecs::impl::ComponentArray<component_t> &ecs::registry::storage()
+{
+    ECS_PROFILE;
+    mComponentManager.registerComponent<component_t>();
+    return *mComponentManager.getComponentArray<component_t>();
+}
+template <typename component_t>
+inline ecs::impl::ComponentArray<component_t> const &ecs::registry::storage() const
+{
+    ECS_PROFILE;
+    return *std::as_const(mComponentManager).getComponentArray<component_t>();
 }
 inline ecs::impl::ComponentManager const &ecs::registry::getComponentManager() const { return mComponentManager; }
 inline ecs::impl::ComponentManager &ecs::registry::getComponentManager() { return mComponentManager; }
 inline ecs::impl::EntityManager const &ecs::registry::getEntityManager() const { return mEntityManager; }
 inline ecs::impl::EntityManager &ecs::registry::getEntityManager() { return mEntityManager; }
+inline ecs::impl::ContextManager const &ecs::registry::ctx() const { return mContext; }
+inline ecs::impl::ContextManager &ecs::registry::ctx() { return mContext; }
+
+template <typename registry_t, typename... Include>
+inline ecs::basic_view<registry_t, Include...>::basic_view(registry_t &registry, query const &terms, std::uint32_t cached) : 
+    mRegistry(&registry), mTerms(terms), mQuery(cached), mPlan(makePlan()) {}
+template <typename registry_t, typename... Include>
+inline typename ecs::basic_view<registry_t, Include...>::arrays_type ecs::basic_view<registry_t, Include...>::getArrays() const
+{
+    return {mRegistry->getComponentManager().template findComponentArray<Include>()...};
+}
+template <typename registry_t, typename... Include>
+inline ecs::impl::QueryCache const *ecs::basic_view<registry_t, Include...>::getQuery() const
+{
+    return mQuery == NULL_QUERY ? nullptr : mRegistry->getEntityManager().findQuery(mQuery);
+}
+template <typename registry_t, typename... Include>
+template <typename func_t>
+inline void ecs::basic_view<registry_t, Include...>::forEachGroup(func_t &&func) const
+{
+    auto const &entityManager = mRegistry->getEntityManager();
+    auto const &groups = entityManager.getGroups();
+    if(impl::QueryCache const *query = getQuery())
+    {
+        for(impl::group_index group : query->groups)
+        {
+            if(!groups[group].empty())
+                func(groups[group]);
+        }
+        return;
+    }
+    if(mRegistry->deterministic() && mTerms.any_mask().any())
+    {
+        // the any terms are visited in component id order, walk the groups in creation order instead
+        auto const &signatures = entityManager.getGroupSignatures();
+        for(impl::group_index group = 0; group < groups.size(); ++group)
+        {
+            if(!groups[group].empty() && mTerms.matches(signatures[group]))
+                func(groups[group]);
+        }
+        return;
+    }
+    entityManager.forEachMatchingGroup(mTerms, [&](impl::group_index group) {
+        if(!groups[group].empty())
+            func(groups[group]);
+        return true;
+    });
+}
+template <typename registry_t, typename... Include>
+inline std::vector<std::pair<ecs::entity const *, ecs::entity const *>> ecs::basic_view<registry_t, Include...>::getChunks(std::size_t grain) const
+{
+    ECS_ASSERT(grain != 0, "Chunks must not be empty");
+    std::vector<std::pair<entity const *, entity const *>> chunks;
+    forEachGroup([&](std::vector<entity> const &group)
+    {
+        for(std::size_t begin = 0; begin < group.size(); begin += grain)
+            chunks.emplace_back(group.data() + begin, group.data() + std::min(begin + grain, group.size()));
+    });
+    return chunks;
+}
+template <typename registry_t, typename... Include>
+inline std::vector<std::size_t> const &ecs::basic_view<registry_t, Include...>::getPivot() const
+{
+    return std::as_const(mRegistry->getComponentManager()).getComponentArrays().get(mPlan.pivot)->entities();
+}
+template <typename registry_t, typename... Include>
+template <typename func_t>
+inline void ecs::basic_view<registry_t, Include...>::forEachPivot(func_t &&func) const
+{
+    auto const &entityManager = mRegistry->getEntityManager();
+    for(std::size_t e : getPivot())
+    {
+        if(mTerms.matches(entityManager.getSignature(static_cast<entity>(e))))
+            func(static_cast<entity>(e));
+    }
+}
+template <typename registry_t, typename... Include>
+inline ecs::view_plan ecs::basic_view<registry_t, Include...>::makePlan() const
+{
+    ECS_PROFILE;
+    view_plan plan;
+    impl::QueryCache const *query = getQuery();
+    plan.cached = query != nullptr;
+    if(query)
+        plan.groups = query->groups.size();
+    else if(auto const *rarest = mRegistry->getEntityManager().getRarestGroups(mTerms))
+        plan.groups = rarest->size();
+    else
+        plan.groups = mRegistry->getEntityManager().getGroups().size();
+    plan.cost = plan.groups;
+
+    auto const &arrays = std::as_const(mRegistry->getComponentManager()).getComponentArrays();
+    signature const &all = mTerms.all_mask();
+    bool found = false;
+    for(component_id id = 0; id < impl::ComponentManager::getNextID(); ++id)
+    {
+        if(!all.test(id) || !arrays.contains(id))
+            continue;
+        std::size_t size = arrays.get(id)->entities().size();
+        if(!found || size < plan.pivotSize)
+        {
+            plan.pivot = id;
+            plan.pivotSize = size;
+            found = true;
+        }
+    }
+    if(found && plan.pivotSize < plan.groups && !mRegistry->deterministic())
+    {
+        plan.kind = view_plan::strategy::pivot;
+        plan.cost = plan.pivotSize;
+    }
+    return plan;
+}
+template <typename registry_t, typename... Include>
+inline ecs::view_plan const &ecs::basic_view<registry_t, Include...>::plan() const
+{
+    return mPlan;
+}
+template <typename registry_t, typename... Include>
+inline ecs::basic_view<registry_t, Include...>::iterator::iterator(basic_view const *view, std::vector<impl::group_index> const *groups, bool verify, std::vector<std::size_t> const *pivot, std::size_t cursor) : 
+    mView(view), mGroups(&view->mRegistry->getEntityManager().getGroups()), mList(groups ? groups->data() : nullptr), mVerify(verify), mCurrent(nullptr), mPivot(pivot), 
+    mCursor(cursor), mCount(pivot ? pivot->size() : groups ? groups->size() : mGroups->size()), mIndex(0), mEntity(0)
+{
+    mCursor = std::min(mCursor, mCount);
+    if(mPivot)
+        skipEntities();
+    else
+        skipGroups();
+}
+template <typename registry_t, typename... Include>
+inline void ecs::basic_view<registry_t, Include...>::iterator::skipEntities()
+{
+    auto const &entityManager = mView->mRegistry->getEntityManager();
+    for(; mCursor < mCount; ++mCursor)
+    {
+        mEntity = static_cast<entity>((*mPivot)[mCursor]);
+        if(mView->mTerms.matches(entityManager.getSignature(mEntity)))
+            return;
+    }
+}
+template <typename registry_t, typename... Include>
+inline void ecs::basic_view<registry_t, Include...>::iterator::skipGroups()
+{
+    auto const &signatures = mView->mRegistry->getEntityManager().getGroupSignatures();
+    for(; mCursor < mCount; ++mCursor)
+    {
+        impl::group_index group = mList ? mList[mCursor] : static_cast<impl::group_index>(mCursor);
+        mCurrent = &(*mGroups)[group];
+        if(!mCurrent->empty() && (!mVerify || mView->mTerms.matches(signatures[group])))
+            return;
+    }
+}
+template <typename registry_t, typename... Include>
+inline typename ecs::basic_view<registry_t, Include...>::iterator &ecs::basic_view<registry_t, Include...>::iterator::operator++()
+{
+    if(mPivot)
+    {
+        ++mCursor;
+        skipEntities();
+        return *this;
+    }
+    if(++mIndex < mCurrent->size())
+        return *this;
+    mIndex = 0;
+    ++mCursor;
+    skipGroups();
+    return *this;
+}
+template <typename registry_t, typename... Include>
+inline typename ecs::basic_view<registry_t, Include...>::iterator ecs::basic_view<registry_t, Include...>::begin() const
+{
+    if(mPlan.kind == view_plan::strategy::pivot)
+        return {this, nullptr, true, &getPivot(), 0};
+    if(impl::QueryCache const *query = getQuery())
+        return {this, &query->groups, false, nullptr, 0};
+    return {this, mRegistry->getEntityManager().getRarestGroups(mTerms), true, nullptr, 0};
+}
+template <typename registry_t, typename... Include>
+inline typename ecs::basic_view<registry_t, Include...>::iterator ecs::basic_view<registry_t, Include...>::end() const
+{
+    if(mPlan.kind == view_plan::strategy::pivot)
+        return {this, nullptr, true, &getPivot(), std::numeric_limits<std::size_t>::max()};
+    if(impl::QueryCache const *query = getQuery())
+        return {this, &query->groups, false, nullptr, std::numeric_limits<std::size_t>::max()};
+    return {this, mRegistry->getEntityManager().getRarestGroups(mTerms), true, nullptr, std::numeric_limits<std::size_t>::max()};
+}
+template <typename registry_t, typename... Include>
+inline std::size_t ecs::basic_view<registry_t, Include...>::size() const
+{
+    ECS_PROFILE;
+    std::size_t size = 0;
+    if(mPlan.kind == view_plan::strategy::pivot)
+        forEachPivot([&](entity) { ++size; });
+    else
+        forEachGroup([&](std::vector<entity> const &group) { size += group.size(); });
+    return size;
+}
+template <typename registry_t, typename... Include>
+inline bool ecs::basic_view<registry_t, Include...>::empty() const
+{
+    return begin() == end();
+}
+template <typename registry_t, typename... Include>
+inline std::vector<ecs::entity> ecs::basic_view<registry_t, Include...>::to_vector() const
+{
+    ECS_PROFILE;
+    std::vector<entity> result;
+    if(mPlan.kind == view_plan::strategy::pivot)
+    {
+        forEachPivot([&](entity e) { result.push_back(e); });
+        return result;
+    }
+    result.reserve(size());
+    forEachGroup([&](std::vector<entity> const &group) { result.insert(result.end(), group.begin(), group.end()); });
+    return result;
+}
+template <typename registry_t, typename... Include>
+template <typename func_t>
+inline void ecs::basic_view<registry_t, Include...>::each(func_t &&func) const
+{
+    ECS_PROFILE;
+    [[maybe_unused]] arrays_type arrays = getArrays();
+    auto call = [&](entity e)
+    {
+        if constexpr(std::is_invocable_v<func_t, entity, component_reference<Include>...>)
+            func(e, std::get<array_pointer<Include>>(arrays)->get(e)...);
+        else
+            func(std::get<array_pointer<Include>>(arrays)->get(e)...);
+    };
+    if(mPlan.kind == view_plan::strategy::pivot)
+    {
+        forEachPivot(call);
+        return;
+    }
+    if constexpr(sizeof...(Include) > 0 && (std::is_same_v<typename impl::ComponentArray<Include>::storage_type, sparse_set<Include>> && ...))
+    {
+        signature included;
+        (included.set(impl::ComponentManager::getComponentID<Include>()), ...);
+        if(mRegistry->arranged(included))
+        {
+            // the components of a group are one contiguous run in each array
+            forEachGroup([&](std::vector<entity> const &group)
+            {
+                std::tuple<component_pointer<Include>...> runs{(std::get<array_pointer<Include>>(arrays)->denseData() + std::get<array_pointer<Include>>(arrays)->getDenseIndex(group.front()))...};
+                for(std::size_t i = 0; i < group.size(); ++i)
+                {
+                    if constexpr(std::is_invocable_v<func_t, entity, component_reference<Include>...>)
+                        func(group[i], std::get<component_pointer<Include>>(runs)[i]...);
+                    else
+                        func(std::get<component_pointer<Include>>(runs)[i]...);
+                }
+            });
+            return;
+        }
+    }
+    forEachGroup([&](std::vector<entity> const &group)
+    {
+        for(entity e : group)
+            call(e);
+    });
+}
+template <typename registry_t, typename... Include>
+template <typename pool_t, typename func_t>
+inline void ecs::basic_view<registry_t, Include...>::par_each(pool_t &pool, func_t &&func, std::size_t grain) const
+{
+    ECS_PROFILE;
+    static_assert(std::is_const_v<registry_t> || (!impl::hasReplace<typename impl::ComponentArray<Include>::storage_type> && ...), "Shared components are copied on write, they can't be written from several threads");
+    auto const chunks = getChunks(grain);
+
+    [[maybe_unused]] arrays_type arrays = getArrays();
+    pool.parallel_for(chunks.size(), [&](std::size_t index)
+    {
+        for(entity const *e = chunks[index].first; e != chunks[index].second; ++e)
+        {
+            if constexpr(std::is_invocable_v<func_t, entity, component_reference<Include>...>)
+                func(*e, std::get<array_pointer<Include>>(arrays)->get(*e)...);
+            else
+                func(std::get<array_pointer<Include>>(arrays)->get(*e)...);
+        }
+    });
+}
+template <typename registry_t, typename... Include>
+template <typename pool_t, typename func_t>
+inline void ecs::basic_view<registry_t, Include...>::par_each_commands(pool_t &pool, func_t &&func, std::size_t grain) const
+{
+    ECS_PROFILE;
+    static_assert(!std::is_const_v<registry_t>, "Structural changes need a non-const registry");
+    static_assert((!impl::hasReplace<typename impl::ComponentArray<Include>::storage_type> && ...), "Shared components are copied on write, they can't be written from several threads");
+    auto const chunks = getChunks(grain);
+    std::vector<command_buffer> buffers;
+    buffers.reserve(chunks.size());
+    for(std::size_t index = 0; index < chunks.size(); ++index)
+        buffers.emplace_back(*mRegistry);
+
+    [[maybe_unused]] arrays_type arrays = getArrays();
+    pool.parallel_for(chunks.size(), [&](std::size_t index)
+    {
+        command_buffer &commands = buffers[index];
+        for(entity const *e = chunks[index].first; e != chunks[index].second; ++e)
+        {
+            if constexpr(std::is_invocable_v<func_t, command_buffer &, entity, component_reference<Include>...>)
+                func(commands, *e, std::get<array_pointer<Include>>(arrays)->get(*e)...);
+            else
+                func(commands, std::get<array_pointer<Include>>(arrays)->get(*e)...);
+        }
+    });
+
+    for(command_buffer &commands : buffers)
+        commands.playback();
+}
+template <typename registry_t, typename... Include>
+inline typename ecs::basic_view<registry_t, Include...>::each_range ecs::basic_view<registry_t, Include...>::each() const
+{
+    return each_range{*this};
+}
+
+template <typename registry_t, typename... Owned>
+inline ecs::basic_group<registry_t, Owned...>::basic_group(registry_t &registry, std::size_t group) : 
+    mRegistry(&registry), mGroup(group) {}
+template <typename registry_t, typename... Owned>
+inline std::size_t ecs::basic_group<registry_t, Owned...>::size() const
+{
+    return mRegistry->getOwningGroups()[mGroup].size;
+}
+template <typename registry_t, typename... Owned>
+inline bool ecs::basic_group<registry_t, Owned...>::empty() const
+{
+    return size() == 0;
+}
+template <typename registry_t, typename... Owned>
+inline typename ecs::basic_group<registry_t, Owned...>::iterator ecs::basic_group<registry_t, Owned...>::begin() const
+{
+    using first_t = std::tuple_element_t<0, std::tuple<Owned...>>;
+    return std::as_const(mRegistry->getComponentManager()).template getComponentArray<first_t>()->sparse().data();
+}
+template <typename registry_t, typename... Owned>
+inline typename ecs::basic_group<registry_t, Owned...>::iterator ecs::basic_group<registry_t, Owned...>::end() const
+{
+    return begin() + size();
+}
+template <typename registry_t, typename... Owned>
+inline std::vector<ecs::entity> ecs::basic_group<registry_t, Owned...>::to_vector() const
+{
+    return {begin(), end()};
+}
+template <typename registry_t, typename... Owned>
+template <typename func_t>
+inline void ecs::basic_group<registry_t, Owned...>::each(func_t &&func) const
+{
+    ECS_PROFILE;
+    std::size_t const count = size();
+    iterator entities = begin();
+    std::tuple<component_pointer<Owned>...> components{mRegistry->getComponentManager().template getComponentArray<Owned>()->denseData()...};
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        if constexpr(std::is_invocable_v<func_t, entity, std::remove_pointer_t<component_pointer<Owned>> &...>)
+            func(entities[i], std::get<component_pointer<Owned>>(components)[i]...);
+        else
+            func(std::get<component_pointer<Owned>>(components)[i]...);
+    }
+}
+
+template <typename key_t, typename... Include>
+inline ecs::sorted_view<key_t, Include...>::sorted_view(key_extractor key) : mKey(std::move(key)) {}
+template <typename key_t, typename... Include>
+inline void ecs::sorted_view<key_t, Include...>::repair()
+{
+    ECS_PROFILE;
+    // a few moves per element are expected from a mostly sorted order
+    std::size_t const budget = 4 * mOrder.size() + 64;
+    std::size_t moves = 0;
+    for(std::size_t i = 1; i < mOrder.size(); ++i)
+    {
+        if(!(mOrder[i] < mOrder[i - 1]))
+            continue;
+        auto value = std::move(mOrder[i]);
+        std::size_t j = i;
+        for(; j > 0 && value < mOrder[j - 1]; --j)
+            mOrder[j] = std::move(mOrder[j - 1]);
+        mOrder[j] = std::move(value);
+
+        moves += i - j;
+        if(moves > budget)
+        {
+            std::sort(mOrder.begin(), mOrder.end());
+            return;
+        }
+    }
+}
+template <typename key_t, typename... Include>
+inline void ecs::sorted_view<key_t, Include...>::update(registry const &registry)
+{
+    ECS_PROFILE;
+    // drop the stale entities and refresh the keys of the others
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < mOrder.size(); ++i)
+    {
+        entity e = mOrder[i].second;
+        if(registry.valid(e) && (registry.has<Include>(e) && ...))
+            mOrder[kept++] = {mKey(registry.get<Include>(e)...), e};
+        else
+            mMembers[e] = false;
+    }
+    mOrder.erase(mOrder.begin() + kept, mOrder.end());
+    repair();
+
+    // sort the new entities and merge them in
+    registry.view<Include...>().each([&](entity e, Include const &...components) {
+        if(e >= mMembers.size())
+            mMembers.resize(e + 1, false);
+        if(mMembers[e])
+            return;
+        mMembers[e] = true;
+        mOrder.emplace_back(mKey(components...), e);
+    });
+    std::sort(mOrder.begin() + kept, mOrder.end());
+    std::inplace_merge(mOrder.begin(), mOrder.begin() + kept, mOrder.end());
+
+    mEntities.resize(mOrder.size());
+    for(std::size_t i = 0; i < mOrder.size(); ++i)
+        mEntities[i] = mOrder[i].second;
+}
+template <typename key_t, typename... Include>
+inline std::vector<ecs::entity> const &ecs::sorted_view<key_t, Include...>::entities() const
+{
+    return mEntities;
+}
+template <typename key_t, typename... Include>
+inline typename ecs::sorted_view<key_t, Include...>::iterator ecs::sorted_view<key_t, Include...>::begin() const
+{
+    return mEntities.begin();
+}
+template <typename key_t, typename... Include>
+inline typename ecs::sorted_view<key_t, Include...>::iterator ecs::sorted_view<key_t, Include...>::end() const
+{
+    return mEntities.end();
+}
+template <typename key_t, typename... Include>
+inline std::size_t ecs::sorted_view<key_t, Include...>::size() const
+{
+    return mEntities.size();
+}
+template <typename key_t, typename... Include>
+inline bool ecs::sorted_view<key_t, Include...>::empty() const
+{
+    return mEntities.empty();
+}
+
+inline ecs::command_buffer::command_buffer(registry &registry) : mRegistry(&registry) {}
+inline ecs::command_buffer::~command_buffer()
+{
+    drop();
+}
+inline void *ecs::command_buffer::allocate(std::size_t size, std::size_t alignment)
+{
+    while(true)
+    {
+        if(mBlock == mBlocks.size())
+        {
+            std::size_t const blockSize = std::max(BLOCK_SIZE, size + alignment);
+            mBlocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[blockSize]), blockSize, 0});
+        }
+        Block &block = mBlocks[mBlock];
+        void *pointer = block.data.get() + block.used;
+        std::size_t space = block.size - block.used;
+        if(std::align(alignment, size, pointer, space))
+        {
+            block.used = block.size - space + size;
+            return pointer;
+        }
+        ++mBlock;
+    }
+}
+inline void ecs::command_buffer::drop()
+{
+    for(Command const &command : mCommands)
+    {
+        if(command.payload)
+            command.drop(command.payload);
+    }
+    mCommands.clear();
+    for(Block &block : mBlocks)
+        block.used = 0;
+    mBlock = 0;
+}
+inline ecs::entity ecs::command_buffer::create()
+{
+    // a reservation depends on the other threads, a position in the buffer does not
+    entity entity = mRegistry->mDeterministic ? PROVISIONAL | static_cast<ecs::entity>(mCreated.size()) : mRegistry->mEntityManager.reserveEntity();
+    mCreated.push_back(entity);
+    return entity;
+}
+inline ecs::entity ecs::command_buffer::created(entity const &entity) const
+{
+    ECS_ASSERT(!(entity & PROVISIONAL) || (entity & ~PROVISIONAL) < mCreated.size(), "Provisional identifier of another buffer");
+    return entity & PROVISIONAL ? mCreated[entity & ~PROVISIONAL] : entity;
+}
+inline ecs::entity ecs::command_buffer::resolve(entity const &entity) const
+{
+    ECS_ASSERT(!(entity & PROVISIONAL) || (entity & ~PROVISIONAL) < mResolved.size(), "Provisional identifier of another buffer");
+    return entity & PROVISIONAL ? mResolved[entity & ~PROVISIONAL] : entity;
+}
+template <typename... Components_t>
+inline ecs::entity ecs::command_buffer::create(Components_t &&...components)
+{
+    entity entity = create();
+    (emplace<std::decay_t<Components_t>>(entity, std::forward<Components_t>(components)), ...);
+    return entity;
+}
+template <typename component_t, class... Args>
+inline void ecs::command_buffer::emplace(entity const &entity, Args &&...args)
+{
+    ECS_PROFILE;
+    void *payload = allocate(sizeof(component_t), alignof(component_t));
+    if constexpr(std::is_aggregate_v<component_t>)
+        new(payload) component_t{std::forward<Args>(args)...};
+    else
+        new(payload) component_t(std::forward<Args>(args)...);
+    mCommands.push_back({entity, impl::ComponentManager::getComponentID<component_t>(), payload,
+        [](impl::ComponentManager &components, ecs::entity entity, void *payload) {
+            component_t *component = static_cast<component_t *>(payload);
+            components.registerComponent<component_t>();
+            components.getComponentArray<component_t>()->emplace(entity, std::move(*component));
+            component->~component_t();
+        },
+        [](void *payload) { static_cast<component_t *>(payload)->~component_t(); },
+        true
+    });
+}
+template <typename component_t>
+inline void ecs::command_buffer::remove(entity const &entity)
+{
+    mCommands.push_back({entity, impl::ComponentManager::getComponentID<component_t>(), nullptr,
+        [](impl::ComponentManager &components, ecs::entity entity, void *) {
+            components.getComponentArray<component_t>()->erase(entity);
+        },
+        nullptr,
+        true
+    });
+}
+inline void ecs::command_buffer::destroy(entity const &entity)
+{
+    mDestroyed.push_back(entity);
+}
+template <typename func_t>
+inline void ecs::command_buffer::then(func_t &&func)
+{
+    mThen.emplace_back(std::forward<func_t>(func));
+}
+inline void ecs::command_buffer::merge(sparse_set<Change> &changes)
+{
+    ECS_PROFILE;
+    impl::EntityManager const &entities = mRegistry->mEntityManager;
+    for(Command &command : mCommands)
+    {
+        command.target = created(command.target);
+        command.live = entities.valid(command.target);
+        if(!command.live)
+            continue;
+        if(!changes.contains(command.target))
+        {
+            signature const &original = entities.getSignature(command.target);
+            changes.emplace(command.target, Change{original, original, {}, {}});
+        }
+        Change &change = changes.get(command.target);
+        if(command.drop)
+        {
+            ECS_ASSERT(!change.current.test(command.component), "Component to emplace already added");
+            change.current.set(command.component);
+            continue;
+        }
+        ECS_ASSERT(change.current.test(command.component), "Component to remove is not added");
+        change.current.reset(command.component);
+        // only the first remove of a component the entity had erases it, the others undo emplaces of the buffer
+        command.live = change.original.test(command.component) && !change.erased.test(command.component);
+        if(command.live)
+            change.erased.set(command.component);
+    }
+
+    // only the last emplace of a component the entity ends up with is applied
+    for(auto command = mCommands.rbegin(); command != mCommands.rend(); ++command)
+    {
+        if(!command->live || !command->drop)
+            continue;
+        Change &change = changes.get(command->target);
+        command->live = change.current.test(command->component) && !change.added.test(command->component);
+        if(command->live)
+            change.added.set(command->component);
+    }
+    for(Command &command : mCommands)
+    {
+        if(!command.live && command.payload)
+        {
+            command.drop(command.payload);
+            command.payload = nullptr;
+        }
+    }
+}
+inline void ecs::command_buffer::playback()
+{
+    ECS_PROFILE;
+    impl::EntityManager &entities = mRegistry->mEntityManager;
+    impl::ComponentManager &components = mRegistry->mComponentManager;
+
+    for(entity &entity : mCreated)
+    {
+        if(entity & PROVISIONAL)
+            entity = entities.createEntity();
+        else
+            entities.createReserved(entity);
+    }
+
+    // the entities change groups in recording order, which does not depend on the component ids
+    sparse_set<Change> changes;
+    try
+    {
+        merge(changes);
+    }
+    catch(...)
+    {
+        // the created entities are still empty, give them back in an order that hands them out again the same way
+        for(auto entity = mCreated.rbegin(); entity != mCreated.rend(); ++entity)
+            entities.destroyEntity(*entity);
+        mCreated.clear();
+        mDestroyed.clear();
+        mThen.clear();
+        drop();
+        throw;
+    }
+
+    // leave the groups once, then empty one component array at a time and fill one at a time
+    for(auto [target, change] : changes)
+    {
+        if(change.erased.none())
+            continue;
+        entity const entity = static_cast<ecs::entity>(target);
+        if(!mRegistry->mOwningGroups.empty())
+            mRegistry->leaveOwningGroups(entity, change.erased);
+        entities.setSignature(entity, change.original & ~change.erased);
+    }
+    std::stable_sort(mCommands.begin(), mCommands.end(), [](Command const &lhs, Command const &rhs) {
+        return std::make_pair(lhs.drop != nullptr, lhs.component) < std::make_pair(rhs.drop != nullptr, rhs.component);
+    });
+    for(Command &command : mCommands)
+    {
+        if(!command.live)
+            continue;
+        command.apply(components, command.target, command.payload);
+        command.payload = nullptr;
+    }
+    mCommands.clear();
+
+    // then enter the final group once
+    for(auto [target, change] : changes)
+    {
+        if(change.added.none())
+            continue;
+        entity const entity = static_cast<ecs::entity>(target);
+        entities.setSignature(entity, change.current);
+        if(!mRegistry->mOwningGroups.empty())
+            mRegistry->enterOwningGroups(entity, change.added);
+    }
+
+    for(entity const &destroyed : mDestroyed)
+    {
+        entity const entity = created(destroyed);
+        if(entities.valid(entity))
+            mRegistry->destroy(entity);
+    }
+
+    mResolved.swap(mCreated);
+    mCreated.clear();
+    mDestroyed.clear();
+    drop();
+
+    // the buffer is empty before the calls, a throwing function leaves it usable
+    auto then = std::move(mThen);
+    mThen.clear();
+    for(auto const &func : then)
+        func(*this);
+}
+inline void ecs::command_buffer::clear()
+{
+    for(entity const &entity : mCreated)
+    {
+        if(!(entity & PROVISIONAL))
+            mRegistry->mEntityManager.releaseReserved(entity);
+    }
+    mCreated.clear();
+    mDestroyed.clear();
+    mThen.clear();
+    drop();
+}
+inline bool ecs::command_buffer::empty() const
+{
+    return mCreated.empty() && mCommands.empty() && mDestroyed.empty() && mThen.empty();
+}
+
+inline ecs::staging_registry::staging_registry(registry &target) : mTarget(&target) {}
+template <typename... Components_t>
+inline ecs::entity ecs::staging_registry::create()
+{
+    return create<Components_t...>(Components_t{}...);
+}
+template <typename... Components_t>
+inline ecs::entity ecs::staging_registry::create(Components_t &&...components)
+{
+    ECS_PROFILE;
+    entity entity = mTarget->mEntityManager.reserveEntity();
+
+    // enter the final group right away, no group is walked per component
+    signature signature;
+    (signature.set(impl::ComponentManager::getComponentID<std::decay_t<Components_t>>()), ...);
+    ECS_ASSERT(signature.count() == sizeof...(Components_t), "Component added more than once");
+    mStaged.mEntityManager.adoptEntity(entity, signature);
+
+    impl::ComponentManager &staged = mStaged.mComponentManager;
+    (staged.registerComponent<std::decay_t<Components_t>>(), ...);
+    (staged.getComponentArray<std::decay_t<Components_t>>()->emplace(entity, std::forward<Components_t>(components)), ...);
+    return entity;
+}
+template <typename component_t, class... Args>
+inline void ecs::staging_registry::emplace(entity const &entity, Args &&...args)
+{
+    mStaged.emplace<component_t>(entity, std::forward<Args>(args)...);
+}
+template <typename component_t>
+inline void ecs::staging_registry::remove(entity const &entity)
+{
+    mStaged.remove<component_t>(entity);
+}
+template <typename component_t>
+inline ecs::storage_reference<component_t> ecs::staging_registry::get(entity const &entity)
+{
+    return mStaged.get<component_t>(entity);
+}
+template <typename component_t>
+inline component_t const &ecs::staging_registry::get(entity const &entity) const
+{
+    return mStaged.get<component_t>(entity);
+}
+template <typename component_t>
+inline bool ecs::staging_registry::has(entity const &entity) const
+{
+    return mStaged.has<component_t>(entity);
+}
+inline bool ecs::staging_registry::valid(entity const &entity) const
+{
+    return mStaged.valid(entity);
+}
+inline void ecs::staging_registry::destroy(entity const &entity)
+{
+    mStaged.destroy(entity);
+    mReleased.push_back(entity);
+}
+inline ecs::registry &ecs::staging_registry::staged()
+{
+    return mStaged;
+}
+inline ecs::registry const &ecs::staging_registry::staged() const
+{
+    return mStaged;
+}
+inline std::size_t ecs::staging_registry::size() const
+{
+    return mStaged.size();
+}
+inline bool ecs::staging_registry::empty() const
+{
+    return mStaged.size() == 0 && mReleased.empty();
+}
+inline void ecs::staging_registry::commit()
+{
+    ECS_PROFILE;
+    impl::EntityManager &entities = mTarget->mEntityManager;
+    auto &arrays = mTarget->mComponentManager.getComponentArrays();
+    auto const &groups = mStaged.mEntityManager.getGroups();
+    auto const &signatures = mStaged.mEntityManager.getGroupSignatures();
+
+    for(std::size_t group = 0; group < groups.size(); ++group)
+        entities.createReserved(groups[group], signatures[group]);
+    for(auto [id, array] : mStaged.mComponentManager.getComponentArrays())
+    {
+        if(array->entities().empty())
+            continue;
+        if(!arrays.contains(id))
+            arrays.emplace(id, array->cloneEmpty());
+        arrays.get(id)->appendFrom(array.get());
+    }
+    if(!mTarget->mOwningGroups.empty())
+    {
+        for(std::size_t group = 0; group < groups.size(); ++group)
+        {
+            for(entity const &entity : groups[group])
+                mTarget->enterOwningGroups(entity, signatures[group]);
+        }
+    }
+
+    for(entity const &entity : mReleased)
+        entities.releaseReserved(entity);
+    mReleased.clear();
+    // the arrays were emptied by the appends, the groups keep their capacity for the next batch
+    mStaged.mEntityManager.forgetEntities();
+}
+inline void ecs::staging_registry::clear()
+{
+    for(entity const &entity : mStaged.view<>())
+        mReleased.push_back(entity);
+    for(entity const &entity : mReleased)
+        mTarget->mEntityManager.releaseReserved(entity);
+    mReleased.clear();
+    mStaged.mEntityManager.forgetEntities();
+    for(auto [id, array] : mStaged.mComponentManager.getComponentArrays())
+        array = array->cloneEmpty();
+}
+
+template <typename... Components>
+inline ecs::snapshot<Components...>::snapshot()
+{
+    (mRegistry.mComponentManager.registerComponent<Components>(), ...);
+}
+template <typename... Components>
+inline void ecs::snapshot<Components...>::extract(registry const &source)
+{
+    ECS_PROFILE;
+    mRegistry.mEntityManager = source.mEntityManager;
+    // the arrays keep their order, an arranged source stays arranged
+    mRegistry.mArrangedComponents = source.mArrangedComponents;
+    mRegistry.mArrangedVersion = source.mArrangedVersion;
+    auto const &arrays = source.mComponentManager.getComponentArrays();
+    ([&] {
+        auto *array = mRegistry.mComponentManager.getComponentArray<Components>();
+        component_id const id = impl::ComponentManager::getComponentID<Components>();
+        if(arrays.contains(id))
+            array->assign(arrays.get(id).get());
+        else
+            array->clear();
+    }(), ...);
+}
+template <typename... Components>
+template <typename... Include, typename... Exclude>
+inline ecs::basic_view<ecs::registry const, Include...> ecs::snapshot<Components...>::view(exclude<Exclude...> toExclude) const
+{
+    static_assert((impl::isAnyOf<std::remove_const_t<Include>, Components...> && ...), "Only the components of the snapshot can be included");
+    return mRegistry.view<Include...>(toExclude);
+}
+template <typename... Components>
+inline bool ecs::snapshot<Components...>::valid(entity const &entity) const
+{
+    return mRegistry.valid(entity);
+}
+template <typename... Components>
+template <typename component_t>
+inline bool ecs::snapshot<Components...>::has(entity const &entity) const
+{
+    return mRegistry.has<component_t>(entity);
+}
+template <typename... Components>
+template <typename component_t>
+inline component_t const &ecs::snapshot<Components...>::get(entity const &entity) const
+{
+    static_assert(impl::isAnyOf<component_t, Components...>, "Only the components of the snapshot can be read");
+    return mRegistry.get<component_t>(entity);
+}
+template <typename... Components>
+inline std::size_t ecs::snapshot<Components...>::size() const
+{
+    return mRegistry.size();
+}
+template <typename... Components>
+template <typename component_t>
+inline ecs::impl::ComponentArray<component_t> const &ecs::snapshot<Components...>::storage() const
+{
+    static_assert(impl::isAnyOf<component_t, Components...>, "Only the components of the snapshot can be read");
+    return mRegistry.storage<component_t>();
+}
+template <typename... Components>
+inline ecs::registry_memory_stats ecs::snapshot<Components...>::memory_usage() const
+{
+    return mRegistry.memory_usage();
+}
 
 /*! \endcond */
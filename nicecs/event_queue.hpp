@@ -0,0 +1,336 @@
+/*
+      ___  ___ ___
+     / _ \/ __/ __|        Copyright (c) 2024 Nikita Martynau
+    |  __/ (__\__ \        https://opensource.org/license/mit
+     \___|\___|___/ v1.5.8 https://github.com/nikitawew/nicecs
+
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "ecs.hpp"
+
+namespace ecs
+{
+    /// @brief A lock-free multi-producer single-consumer queue of events, e.g. damage dealt or collisions emitted by parallel systems.
+    /// Producers claim slots in fixed size chunks with one fetch_add, and only allocate when a chunk is full.
+    /// The consumer drains the queue at a sync point, when no producer is running, and gets the events chunk by chunk as contiguous spans.
+    /// Events can target an entity, they are dropped at drain if the target was destroyed meanwhile, even if its identifier was reused since.
+    /// Events pushed from several threads come in the order the threads claimed their slots.
+    /// @code
+    /// auto &hits = ecs::events<Hit>(registry);
+    /// registry.view<Position>().par_each(pool, [&](ecs::entity e, Position const &) { hits.push_to(registry, e, 10); });
+    /// hits.drain(registry, [&](auto span) { for(std::size_t i = 0; i < span.size(); ++i) registry.get<Health>(span.target(i)).hp -= span[i].damage; });
+    /// @endcode
+    /// @tparam event_t The type of events.
+    template<typename event_t>
+    class event_queue
+    {
+    public:
+        /// @brief Number of events in one chunk.
+        static constexpr std::size_t CHUNK_SIZE = 256;
+        /// @brief The target of events that have none.
+        static constexpr entity NO_TARGET = 0;
+
+        /// @brief Contiguous events of a chunk, handed out by drain.
+        class span
+        {
+        private:
+            event_t *mData;
+            entity const *mTargets;
+            std::size_t mSize;
+        public:
+            inline span(event_t *data, entity const *targets, std::size_t size) : mData(data), mTargets(targets), mSize(size) {}
+
+            inline event_t *data() const { return mData; }
+            inline std::size_t size() const { return mSize; }
+            inline bool empty() const { return mSize == 0; }
+            inline event_t *begin() const { return mData; }
+            inline event_t *end() const { return mData + mSize; }
+            inline event_t &operator[](std::size_t index) const { return mData[index]; }
+            /// @brief Get the entity an event targets, NO_TARGET if it has none.
+            inline entity target(std::size_t index) const { return mTargets[index]; }
+        };
+    private:
+        /// @brief Marks a claimed slot whose event failed to construct.
+        static constexpr entity DROPPED = std::numeric_limits<entity>::max();
+
+        struct Chunk
+        {
+            alignas(event_t) unsigned char events[CHUNK_SIZE * sizeof(event_t)];
+            entity targets[CHUNK_SIZE];
+            /// @brief The generations of the targets at push, see impl::EntityManager::getGeneration.
+            std::uint32_t generations[CHUNK_SIZE];
+            /// @brief Claimed slots, may go past CHUNK_SIZE while producers race for the next chunk.
+            std::atomic<std::size_t> claimed{0};
+            std::atomic<Chunk *> next{nullptr};
+
+            inline event_t *data() { return std::launder(reinterpret_cast<event_t *>(events)); }
+            inline std::size_t size() const { return std::min(claimed.load(std::memory_order_relaxed), CHUNK_SIZE); }
+        };
+
+        Chunk *mHead;
+        std::atomic<Chunk *> mTail;
+
+        /// @brief Get the chunk after a full one, appending it if needed.
+        Chunk *nextChunk(Chunk *full);
+        /// @brief Call func(chunk) for every chunk that may hold events, from the head to the tail.
+        /// Does not stop at empty chunks, the ones already drained when a consumer threw are followed by pending ones.
+        template<typename func_t>
+        void forEachChunk(func_t &&func) const;
+        /// @brief Claim a slot and construct an event in it.
+        template<class... Args>
+        void emplace(entity target, std::uint32_t generation, Args &&...args);
+        /// @brief Copy the events of another queue, which no producer uses.
+        void append(event_queue const &other);
+    public:
+        event_queue();
+        ~event_queue();
+        /// @brief Copy the pending events. Not thread safe against producers of @p other.
+        /// A queue of events that are not copyable can only be copied empty, e.g. with the registry that keeps it.
+        event_queue(event_queue const &other);
+        /// @copydoc event_queue(event_queue const &)
+        event_queue &operator=(event_queue const &other);
+
+        /// @brief Push an event. Thread safe against other pushes.
+        /// @param args The arguments to construct the event with.
+        template<class... Args>
+        void push(Args &&...args);
+        /// @brief Push an event targeting an entity. Thread safe against other pushes and const access to @p registry.
+        /// @param registry The registry the target belongs to.
+        /// @param target A valid entity, the event is dropped at drain if it was destroyed meanwhile.
+        /// @param args The arguments to construct the event with.
+        template<class... Args>
+        void push_to(registry const &registry, entity const &target, Args &&...args);
+
+        /// @brief Hand out the pending events and clear the queue. Not thread safe against pushes.
+        /// Events targeting entities destroyed in @p registry since the push are dropped. The chunks are kept for the next pushes.
+        /// @param registry The registry the targets belong to.
+        /// @param func Called with every non-empty span, in the order of the chunks. If it throws, the remaining events are dropped.
+        template<typename func_t>
+        void drain(registry const &registry, func_t &&func);
+
+        /// @brief Get the number of pending events, including the ones drain would drop.
+        /// Only a hint while producers run.
+        std::size_t size() const;
+
+        /// @return True if there are no pending events, false otherwise.
+        bool empty() const;
+
+        /// @brief Drop the pending events. Not thread safe against pushes.
+        void clear();
+    };
+
+    /// @brief Get the event queue of a registry, kept in its context.
+    /// The queue is created on first use, which is not thread safe. Get it once before pushing from several threads,
+    /// e.g. in the first run of a system, which runs alone (see scheduler).
+    /// @tparam event_t The type of events.
+    template<typename event_t>
+    event_queue<event_t> &events(registry &registry);
+} // namespace ecs
+
+/*! \cond Doxygen_Suppress */
+
+template <typename event_t>
+inline ecs::event_queue<event_t>::event_queue() : mHead(new Chunk), mTail(mHead) {}
+template <typename event_t>
+inline ecs::event_queue<event_t>::~event_queue()
+{
+    clear();
+    for(Chunk *chunk = mHead; chunk;)
+    {
+        Chunk *next = chunk->next.load(std::memory_order_relaxed);
+        delete chunk;
+        chunk = next;
+    }
+}
+template <typename event_t>
+inline ecs::event_queue<event_t>::event_queue(event_queue const &other) : event_queue()
+{
+    append(other);
+}
+template <typename event_t>
+inline ecs::event_queue<event_t> &ecs::event_queue<event_t>::operator=(event_queue const &other)
+{
+    if(this != &other)
+    {
+        clear();
+        append(other);
+    }
+    return *this;
+}
+template <typename event_t>
+inline void ecs::event_queue<event_t>::append(event_queue const &other)
+{
+    ECS_PROFILE;
+    if constexpr(std::is_copy_constructible_v<event_t>)
+    {
+        other.forEachChunk([&](Chunk *chunk) {
+            for(std::size_t index = 0; index < chunk->size(); ++index)
+            {
+                if(chunk->targets[index] != DROPPED)
+                    emplace(chunk->targets[index], chunk->generations[index], std::as_const(chunk->data()[index]));
+            }
+        });
+    }
+    else
+        ECS_ASSERT(other.empty(), "Copying events that are not copyable");
+}
+template <typename event_t>
+inline typename ecs::event_queue<event_t>::Chunk *ecs::event_queue<event_t>::nextChunk(Chunk *full)
+{
+    Chunk *next = full->next.load(std::memory_order_acquire);
+    if(!next)
+    {
+        // racing producers may allocate a chunk each, one of them is linked
+        std::unique_ptr<Chunk> fresh{new Chunk};
+        if(full->next.compare_exchange_strong(next, fresh.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+            next = fresh.release();
+    }
+    mTail.compare_exchange_strong(full, next, std::memory_order_acq_rel, std::memory_order_relaxed);
+    return next;
+}
+template <typename event_t>
+template <typename func_t>
+inline void ecs::event_queue<event_t>::forEachChunk(func_t &&func) const
+{
+    Chunk *const tail = mTail.load(std::memory_order_relaxed);
+    for(Chunk *chunk = mHead;; chunk = chunk->next.load(std::memory_order_relaxed))
+    {
+        func(chunk);
+        if(chunk == tail)
+            break;
+    }
+}
+template <typename event_t>
+template <class... Args>
+inline void ecs::event_queue<event_t>::emplace(entity target, std::uint32_t generation, Args &&...args)
+{
+    Chunk *chunk = mTail.load(std::memory_order_acquire);
+    std::size_t index = chunk->claimed.fetch_add(1, std::memory_order_relaxed);
+    while(index >= CHUNK_SIZE)
+    {
+        chunk = nextChunk(chunk);
+        index = chunk->claimed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the slot is claimed for good, a failed construction leaves a hole for drain to skip
+    chunk->targets[index] = DROPPED;
+    if constexpr(impl::isBraceInitialized<event_t, Args...>)
+        new(chunk->data() + index) event_t{std::forward<Args>(args)...};
+    else
+        new(chunk->data() + index) event_t(std::forward<Args>(args)...);
+    chunk->generations[index] = generation;
+    chunk->targets[index] = target;
+}
+template <typename event_t>
+template <class... Args>
+inline void ecs::event_queue<event_t>::push(Args &&...args)
+{
+    emplace(NO_TARGET, 0, std::forward<Args>(args)...);
+}
+template <typename event_t>
+template <class... Args>
+inline void ecs::event_queue<event_t>::push_to(registry const &registry, entity const &target, Args &&...args)
+{
+    ECS_ASSERT(registry.valid(target), "Invalid entity identifier");
+    emplace(target, registry.getEntityManager().getGeneration(target), std::forward<Args>(args)...);
+}
+template <typename event_t>
+template <typename func_t>
+inline void ecs::event_queue<event_t>::drain(registry const &registry, func_t &&func)
+{
+    ECS_PROFILE;
+    auto const &entityManager = registry.getEntityManager();
+    forEachChunk([&](Chunk *chunk) {
+        // move the events to keep to the front of the chunk
+        event_t *events = chunk->data();
+        std::size_t kept = 0;
+        for(std::size_t index = 0; index < chunk->size(); ++index)
+        {
+            entity const target = chunk->targets[index];
+            if(target == DROPPED)
+                continue;
+            if(target != NO_TARGET && (!entityManager.valid(target) || entityManager.getGeneration(target) != chunk->generations[index]))
+            {
+                events[index].~event_t();
+                continue;
+            }
+            if(kept != index)
+            {
+                new(events + kept) event_t(std::move(events[index]));
+                events[index].~event_t();
+                chunk->targets[kept] = target;
+            }
+            ++kept;
+        }
+        chunk->claimed.store(kept, std::memory_order_relaxed);
+
+        if(kept != 0)
+        {
+            try
+            {
+                func(span{events, chunk->targets, kept});
+            }
+            catch(...)
+            {
+                clear();
+                throw;
+            }
+        }
+        for(std::size_t index = 0; index < kept; ++index)
+            events[index].~event_t();
+        chunk->claimed.store(0, std::memory_order_relaxed);
+    });
+    mTail.store(mHead, std::memory_order_relaxed);
+}
+template <typename event_t>
+inline std::size_t ecs::event_queue<event_t>::size() const
+{
+    std::size_t size = 0;
+    for(Chunk *chunk = mHead; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+        size += chunk->size();
+    return size;
+}
+template <typename event_t>
+inline bool ecs::event_queue<event_t>::empty() const
+{
+    return mHead->size() == 0;
+}
+template <typename event_t>
+inline void ecs::event_queue<event_t>::clear()
+{
+    ECS_PROFILE;
+    forEachChunk([](Chunk *chunk) {
+        for(std::size_t index = 0; index < chunk->size(); ++index)
+        {
+            if(chunk->targets[index] != DROPPED)
+                chunk->data()[index].~event_t();
+        }
+        chunk->claimed.store(0, std::memory_order_relaxed);
+    });
+    mTail.store(mHead, std::memory_order_relaxed);
+}
+template <typename event_t>
+inline ecs::event_queue<event_t> &ecs::events(registry &registry)
+{
+    if(auto *queue = registry.ctx().find<event_queue<event_t>>())
+        return *queue;
+    return registry.ctx().emplace<event_queue<event_t>>();
+}
+
+/*! \endcond */
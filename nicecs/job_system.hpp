@@ -0,0 +1,500 @@
+/*
+      ___  ___ ___
+     / _ \/ __/ __|        Copyright (c) 2024 Nikita Martynau
+    |  __/ (__\__ \        https://opensource.org/license/mit
+     \___|\___|___/ v1.5.8 https://github.com/nikitawew/nicecs
+
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ecs
+{
+    /// @brief A work-stealing scheduler for many short jobs.
+    /// Every worker thread owns a deque of jobs: it pushes and pops at the bottom, idle threads steal from the top of the others. Jobs scheduled by other threads go to a shared queue.
+    /// Threads waiting for a job (see wait and parallel_for) run other jobs meanwhile, so jobs may wait for jobs. Only one thread that is not a worker can wait at a time, the others block until it is done.
+    /// Can be used as the pool of basic_view::par_each.
+    class job_system
+    {
+    private:
+        struct Job
+        {
+            void (*execute)(job_system &, Job &);
+        };
+        /// @brief A job of run or then.
+        struct TaskJob : public Job
+        {
+            std::function<void()> func;
+            std::mutex mutex;
+            bool finished = false; // guarded by mutex
+            std::vector<std::shared_ptr<TaskJob>> continuations; // guarded by mutex
+            std::atomic<bool> done{false};
+            std::exception_ptr exception;
+            std::shared_ptr<TaskJob> self; // keeps the job alive while it is scheduled
+        };
+        struct ForBatch;
+        /// @brief A range of parallel_for indices, split in halves while it is larger than the leaf size.
+        struct RangeJob : public Job
+        {
+            ForBatch *batch;
+            std::size_t begin;
+            std::size_t end;
+        };
+        /// @brief A parallel_for call. Lives on the stack of the caller.
+        struct ForBatch
+        {
+            std::function<void(std::size_t)> const *func;
+            std::size_t leaf;
+            std::atomic<std::size_t> remaining;
+            std::vector<RangeJob> jobs;
+            std::atomic<std::size_t> nextJob{0};
+            std::mutex mutex;
+            std::exception_ptr exception; // guarded by mutex
+        };
+        /// @brief Chase-Lev deque of a fixed capacity. Only the owner pushes and pops, anyone steals.
+        class Deque
+        {
+        private:
+            static constexpr std::int64_t CAPACITY = 1024;
+            alignas(64) std::atomic<std::int64_t> mTop{0};
+            alignas(64) std::atomic<std::int64_t> mBottom{0};
+            std::unique_ptr<std::atomic<Job *>[]> mBuffer{new std::atomic<Job *>[CAPACITY]};
+        public:
+            /// @return False if the deque is full.
+            bool push(Job *job);
+            Job *pop();
+            Job *steal();
+            bool empty() const;
+        };
+        /// @brief The job system and the deque of the current thread.
+        struct Context
+        {
+            job_system *system = nullptr;
+            std::size_t index = 0;
+            std::uint32_t random = 0x9e3779b9;
+        };
+
+        std::size_t mWorkers; // the threads are read while they are started
+        std::vector<std::thread> mThreads;
+        std::unique_ptr<Deque[]> mDeques; // one for every worker and one for the waiting outside thread
+        std::mutex mExternalMutex;
+        std::mutex mInjectedMutex;
+        std::deque<Job *> mInjected;
+        std::atomic<std::size_t> mInjectedCount{0};
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::atomic<std::size_t> mSleeping{0};
+        std::size_t mEpoch = 0; // guarded by mMutex
+        std::atomic<bool> mStop{false};
+
+        static Context &current();
+        static void executeTask(job_system &system, Job &job);
+        static void executeRange(job_system &system, Job &job);
+        void work(std::size_t index);
+        void schedule(Job *job);
+        void notify();
+        bool hasWork() const;
+        Job *findJob(Context &context);
+        void split(ForBatch &batch, std::size_t begin, std::size_t end);
+        /// @brief Call func with the deque index of the current thread, taking the outside deque if needed.
+        template<typename func_t>
+        void participate(func_t &&func);
+    public:
+        /// @brief A scheduled job.
+        class handle
+        {
+        private:
+            friend class job_system;
+            std::shared_ptr<TaskJob> mJob;
+        public:
+            /// @brief Check if the job has finished. An empty handle is always done.
+            bool done() const;
+        };
+
+        /// @param threads The number of worker threads, besides the waiting thread.
+        explicit job_system(std::size_t threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() - 1 : 0);
+        /// @brief Stops the workers. Jobs that did not start are dropped.
+        ~job_system();
+        job_system(job_system const &) = delete;
+        job_system &operator=(job_system const &) = delete;
+
+        /// @brief Get the number of threads running the jobs, including the waiting thread.
+        std::size_t size() const;
+
+        /// @brief Schedule a job.
+        /// @param func The job.
+        /// @return The handle to wait for or continue from.
+        handle run(std::function<void()> func);
+        /// @brief Schedule a job once another job finishes.
+        /// @param before The job to continue. The continuation runs even if it threw, an empty handle is already done.
+        /// @param func The continuation.
+        /// @return The handle of the continuation.
+        handle then(handle const &before, std::function<void()> func);
+        /// @brief Run jobs until the given one finishes. Rethrows its exception.
+        void wait(handle const &job);
+
+        /// @brief Call func(index) for every index in [0, count), spread over the threads.
+        /// The range is split in halves on demand, idle threads steal the larger halves. Blocks until all the calls return, the first exception thrown is rethrown.
+        /// May be called from jobs.
+        /// @param count The number of tasks.
+        /// @param func The task.
+        void parallel_for(std::size_t count, std::function<void(std::size_t)> const &func);
+    };
+} // namespace ecs
+
+/*! \cond Doxygen_Suppress */
+
+inline bool ecs::job_system::Deque::push(Job *job)
+{
+    std::int64_t const bottom = mBottom.load(std::memory_order_relaxed);
+    if(bottom - mTop.load(std::memory_order_acquire) >= CAPACITY)
+        return false;
+    mBuffer[bottom & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+    mBottom.store(bottom + 1, std::memory_order_seq_cst);
+    return true;
+}
+inline ecs::job_system::Job *ecs::job_system::Deque::pop()
+{
+    std::int64_t const bottom = mBottom.load(std::memory_order_relaxed) - 1;
+    mBottom.store(bottom, std::memory_order_seq_cst);
+    std::int64_t top = mTop.load(std::memory_order_seq_cst);
+    if(top > bottom)
+    {
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job *job = mBuffer[bottom & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if(top == bottom)
+    {
+        // the last job, race the thieves for it
+        if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+inline ecs::job_system::Job *ecs::job_system::Deque::steal()
+{
+    std::int64_t top = mTop.load(std::memory_order_seq_cst);
+    std::int64_t const bottom = mBottom.load(std::memory_order_seq_cst);
+    if(top >= bottom)
+        return nullptr;
+    Job *job = mBuffer[top & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+inline bool ecs::job_system::Deque::empty() const
+{
+    return mBottom.load(std::memory_order_seq_cst) <= mTop.load(std::memory_order_seq_cst);
+}
+
+inline bool ecs::job_system::handle::done() const
+{
+    return !mJob || mJob->done.load(std::memory_order_acquire);
+}
+
+inline ecs::job_system::job_system(std::size_t threads) : mWorkers(threads), mDeques(new Deque[threads + 1])
+{
+    mThreads.reserve(threads);
+    for(std::size_t i = 0; i < threads; ++i)
+        mThreads.emplace_back([this, i]() { work(i); });
+}
+inline ecs::job_system::~job_system()
+{
+    {
+        std::lock_guard lock(mMutex);
+        mStop.store(true, std::memory_order_seq_cst);
+        ++mEpoch;
+    }
+    mWake.notify_all();
+    for(auto &thread : mThreads)
+        thread.join();
+
+    // release the jobs that never ran
+    auto release = [](Job *job) {
+        if(job->execute == &executeTask)
+            static_cast<TaskJob *>(job)->self.reset();
+    };
+    for(Job *job : mInjected)
+        release(job);
+    for(std::size_t i = 0; i <= mWorkers; ++i)
+        while(Job *job = mDeques[i].pop())
+            release(job);
+}
+inline std::size_t ecs::job_system::size() const
+{
+    return mWorkers + 1;
+}
+inline ecs::job_system::Context &ecs::job_system::current()
+{
+    static thread_local Context context;
+    return context;
+}
+inline void ecs::job_system::executeTask(job_system &system, Job &job)
+{
+    auto &task = static_cast<TaskJob &>(job);
+    auto const keep = std::move(task.self);
+    try
+    {
+        task.func();
+    }
+    catch(...)
+    {
+        task.exception = std::current_exception();
+    }
+
+    std::vector<std::shared_ptr<TaskJob>> continuations;
+    {
+        std::lock_guard lock(task.mutex);
+        task.finished = true;
+        continuations.swap(task.continuations);
+    }
+    task.done.store(true, std::memory_order_release);
+    for(auto &continuation : continuations)
+        system.schedule(continuation.get());
+}
+inline void ecs::job_system::executeRange(job_system &system, Job &job)
+{
+    auto &range = static_cast<RangeJob &>(job);
+    system.split(*range.batch, range.begin, range.end);
+}
+inline void ecs::job_system::split(ForBatch &batch, std::size_t begin, std::size_t end)
+{
+    // keep the first half, leave the second one to thieves
+    while(end - begin > batch.leaf)
+    {
+        std::size_t const slot = batch.nextJob.fetch_add(1, std::memory_order_relaxed);
+        if(slot >= batch.jobs.size())
+            break;
+        std::size_t const middle = begin + (end - begin) / 2;
+        RangeJob &job = batch.jobs[slot];
+        job.execute = &executeRange;
+        job.batch = &batch;
+        job.begin = middle;
+        job.end = end;
+        schedule(&job);
+        end = middle;
+    }
+
+    for(std::size_t index = begin; index < end; ++index)
+    {
+        try
+        {
+            (*batch.func)(index);
+        }
+        catch(...)
+        {
+            std::lock_guard lock(batch.mutex);
+            if(!batch.exception)
+                batch.exception = std::current_exception();
+        }
+    }
+    batch.remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+}
+inline void ecs::job_system::schedule(Job *job)
+{
+    Context const &context = current();
+    if(context.system != this || !mDeques[context.index].push(job))
+    {
+        std::lock_guard lock(mInjectedMutex);
+        mInjected.push_back(job);
+        mInjectedCount.fetch_add(1, std::memory_order_seq_cst);
+    }
+    notify();
+}
+inline void ecs::job_system::notify()
+{
+    if(mSleeping.load(std::memory_order_seq_cst) == 0)
+        return;
+    {
+        std::lock_guard lock(mMutex);
+        ++mEpoch;
+    }
+    mWake.notify_one();
+}
+inline bool ecs::job_system::hasWork() const
+{
+    if(mInjectedCount.load(std::memory_order_seq_cst) != 0)
+        return true;
+    for(std::size_t i = 0; i <= mWorkers; ++i)
+        if(!mDeques[i].empty())
+            return true;
+    return false;
+}
+inline ecs::job_system::Job *ecs::job_system::findJob(Context &context)
+{
+    if(Job *job = mDeques[context.index].pop())
+        return job;
+    if(mInjectedCount.load(std::memory_order_acquire) != 0)
+    {
+        std::lock_guard lock(mInjectedMutex);
+        if(!mInjected.empty())
+        {
+            Job *job = mInjected.front();
+            mInjected.pop_front();
+            mInjectedCount.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    // xorshift picks the first victim, so thieves spread out
+    context.random ^= context.random << 13;
+    context.random ^= context.random >> 17;
+    context.random ^= context.random << 5;
+    std::size_t const count = mWorkers + 1;
+    std::size_t const start = context.random % count;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t const victim = (start + i) % count;
+        if(victim == context.index)
+            continue;
+        if(Job *job = mDeques[victim].steal())
+            return job;
+    }
+    return nullptr;
+}
+inline void ecs::job_system::work(std::size_t index)
+{
+    Context &context = current();
+    context.system = this;
+    context.index = index;
+    context.random += static_cast<std::uint32_t>(index) * 0x85ebca6b;
+
+    unsigned idle = 0;
+    while(!mStop.load(std::memory_order_acquire))
+    {
+        if(Job *job = findJob(context))
+        {
+            job->execute(*this, *job);
+            idle = 0;
+            continue;
+        }
+        if(++idle < 64)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        idle = 0;
+
+        std::unique_lock lock(mMutex);
+        mSleeping.fetch_add(1, std::memory_order_seq_cst);
+        std::size_t const epoch = mEpoch;
+        if(!mStop.load(std::memory_order_relaxed) && !hasWork())
+            mWake.wait(lock, [&]() { return mEpoch != epoch; });
+        mSleeping.fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+template<typename func_t>
+inline void ecs::job_system::participate(func_t &&func)
+{
+    Context &context = current();
+    if(context.system == this)
+    {
+        func(context);
+        return;
+    }
+
+    std::lock_guard lock(mExternalMutex);
+    Context const previous = context;
+    context.system = this;
+    context.index = mWorkers;
+    try
+    {
+        func(context);
+    }
+    catch(...)
+    {
+        context = previous;
+        throw;
+    }
+    context = previous;
+}
+inline ecs::job_system::handle ecs::job_system::run(std::function<void()> func)
+{
+    handle result;
+    result.mJob = std::make_shared<TaskJob>();
+    result.mJob->execute = &executeTask;
+    result.mJob->func = std::move(func);
+    result.mJob->self = result.mJob;
+    schedule(result.mJob.get());
+    return result;
+}
+inline ecs::job_system::handle ecs::job_system::then(handle const &before, std::function<void()> func)
+{
+    handle result;
+    result.mJob = std::make_shared<TaskJob>();
+    result.mJob->execute = &executeTask;
+    result.mJob->func = std::move(func);
+    result.mJob->self = result.mJob;
+    if(before.mJob)
+    {
+        std::lock_guard lock(before.mJob->mutex);
+        if(!before.mJob->finished)
+        {
+            before.mJob->continuations.push_back(result.mJob);
+            return result;
+        }
+    }
+    schedule(result.mJob.get());
+    return result;
+}
+inline void ecs::job_system::wait(handle const &job)
+{
+    if(!job.mJob)
+        return;
+    participate([&](Context &context) {
+        while(!job.done())
+        {
+            if(Job *next = findJob(context))
+                next->execute(*this, *next);
+            else
+                std::this_thread::yield();
+        }
+    });
+    if(job.mJob->exception)
+        std::rethrow_exception(job.mJob->exception);
+}
+inline void ecs::job_system::parallel_for(std::size_t count, std::function<void(std::size_t)> const &func)
+{
+    if(count == 0)
+        return;
+    ForBatch batch;
+    batch.func = &func;
+    batch.leaf = count / (size() * 4);
+    if(batch.leaf == 0)
+        batch.leaf = 1;
+    batch.remaining.store(count, std::memory_order_relaxed);
+    batch.jobs.resize(2 * (count / batch.leaf) + 1);
+
+    participate([&](Context &context) {
+        split(batch, 0, count);
+        while(batch.remaining.load(std::memory_order_acquire) != 0)
+        {
+            if(Job *job = findJob(context))
+                job->execute(*this, *job);
+            else
+                std::this_thread::yield();
+        }
+    });
+    if(batch.exception)
+        std::rethrow_exception(batch.exception);
+}
+
+/*! \endcond */
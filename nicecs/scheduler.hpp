@@ -0,0 +1,357 @@
+/*
+      ___  ___ ___
+     / _ \/ __/ __|        Copyright (c) 2024 Nikita Martynau
+    |  __/ (__\__ \        https://opensource.org/license/mit
+     \___|\___|___/ v1.5.8 https://github.com/nikitawew/nicecs
+
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ecs.hpp"
+#include "job_system.hpp"
+
+namespace ecs
+{
+    /// @brief Components a system reads. Used with scheduler::add.
+    template<typename... Components>
+    struct reads {};
+    /// @brief Components a system writes. Used with scheduler::add.
+    template<typename... Components>
+    struct writes {};
+
+    /// @brief How long a system took.
+    struct system_timing
+    {
+        std::string name;
+        /// @brief The last run.
+        std::chrono::nanoseconds last{0};
+        /// @brief All the runs since the last reset.
+        std::chrono::nanoseconds total{0};
+        std::size_t runs = 0;
+    };
+
+    /// @brief Runs systems over a registry, in parallel where their component access allows.
+    /// Two systems conflict if one writes a component the other reads or writes, or if either of them is exclusive. Conflicting systems run in the order they were added, the rest run concurrently.
+    /// With a job_system, every system is a job that starts as soon as the systems it conflicts with are done: the last of them to finish schedules it.
+    /// With any other pool, the systems are grouped in waves: a system goes to the wave after the last one holding a system it conflicts with. The waves run one after another, the systems of a wave run on the threads of the pool.
+    /// While systems share the registry, the views they make do not register their queries, which would write the query caches: queries first seen then test every group.
+    /// The views of add_each systems are registered before every run, and a system runs alone the first time, so the queries and context variables (e.g. ecs::events) it uses get registered.
+    /// Structural changes (create, emplace, remove, destroy) need an exclusive system.
+    class scheduler
+    {
+    private:
+        struct System
+        {
+            std::function<void(registry &)> func;
+            /// @brief Registers the queries of the system, empty if they are not known.
+            std::function<void(registry &)> prepare;
+            signature reads;
+            signature writes;
+            bool exclusive = false;
+            bool warm = false; // ran once
+        };
+
+        std::vector<System> mSystems;
+        std::vector<system_timing> mTimings;
+        std::vector<std::vector<std::size_t>> mWaves;
+        /// @brief The earlier systems every system conflicts with.
+        std::vector<std::vector<std::size_t>> mBefore;
+        /// @brief The later systems every system conflicts with.
+        std::vector<std::vector<std::size_t>> mAfter;
+        bool mDirty = false;
+
+        template<typename... Components>
+        static void addAccess(System &system, reads<Components...>);
+        template<typename... Components>
+        static void addAccess(System &system, writes<Components...>);
+        static bool conflicts(System const &lhs, System const &rhs);
+        std::size_t addSystem(std::string name, System system);
+        void build();
+        /// @brief Register the known queries, then let the systems share the registry until destroyed.
+        struct Sharing
+        {
+            registry &shared;
+            Sharing(scheduler &scheduler, registry &registry);
+            ~Sharing();
+        };
+        bool warm() const;
+        void runSystem(std::size_t index, registry &registry);
+    public:
+        /// @brief Add a system.
+        /// @param name The name of the system, see timings.
+        /// @param func The system.
+        /// @param access The components the system touches, any number of ecs::reads and ecs::writes.
+        /// @return The index of the system.
+        template<typename... Access>
+        std::size_t add(std::string name, std::function<void(registry &)> func, Access... access);
+        /// @brief Add a system that runs alone. Structural changes need one.
+        /// @param name The name of the system, see timings.
+        /// @param func The system.
+        /// @return The index of the system.
+        std::size_t add_exclusive(std::string name, std::function<void(registry &)> func);
+        /// @brief Add a system calling func for every entity of registry::view<Include...>, see basic_view::each.
+        /// Const included components are read, the others are written.
+        /// @code
+        /// scheduler.add_each<Position, Velocity const>("movement", [](Position &position, Velocity const &velocity) { position.x += velocity.dx; });
+        /// @endcode
+        /// @param name The name of the system, see timings.
+        /// @param func The function.
+        /// @return The index of the system.
+        template<typename... Include, typename func_t>
+        std::size_t add_each(std::string name, func_t func);
+
+        /// @brief Get the number of systems.
+        std::size_t size() const;
+        /// @brief Get the indices of the systems of every wave, in the order they run.
+        std::vector<std::vector<std::size_t>> const &waves();
+
+        /// @brief Run every system once, wave by wave.
+        /// @param pool The pool running the systems of a wave, any type with a parallel_for(count, func) member (see basic_view::par_each).
+        template<typename pool_t>
+        void run(registry &registry, pool_t &pool);
+        /// @brief Run every system once, as a graph of jobs. A system starts once the earlier systems it conflicts with are done, no job waits for another.
+        /// If a system throws, the later systems it conflicts with are skipped, the others still run, then the first exception is rethrown.
+        /// @param jobs The job system.
+        void run(registry &registry, job_system &jobs);
+        /// @brief Run every system once, on the calling thread.
+        void run(registry &registry);
+
+        /// @brief Get the timing of every system, indexed like the systems.
+        std::vector<system_timing> const &timings() const;
+        /// @brief Clear the timings.
+        void reset_timings();
+    };
+} // namespace ecs
+
+/*! \cond Doxygen_Suppress */
+
+template <typename... Components>
+inline void ecs::scheduler::addAccess(System &system, reads<Components...>)
+{
+    (system.reads.set(impl::ComponentManager::getComponentID<Components>()), ...);
+}
+template <typename... Components>
+inline void ecs::scheduler::addAccess(System &system, writes<Components...>)
+{
+    (system.writes.set(impl::ComponentManager::getComponentID<Components>()), ...);
+}
+inline bool ecs::scheduler::conflicts(System const &lhs, System const &rhs)
+{
+    return lhs.exclusive || rhs.exclusive || (lhs.writes & (rhs.reads | rhs.writes)).any() || (rhs.writes & lhs.reads).any();
+}
+inline std::size_t ecs::scheduler::addSystem(std::string name, System system)
+{
+    ECS_PROFILE;
+    mSystems.push_back(std::move(system));
+    mTimings.emplace_back();
+    mTimings.back().name = std::move(name);
+    mDirty = true;
+    return mSystems.size() - 1;
+}
+template <typename... Access>
+inline std::size_t ecs::scheduler::add(std::string name, std::function<void(registry &)> func, Access... access)
+{
+    System system;
+    system.func = std::move(func);
+    (addAccess(system, access), ...);
+    return addSystem(std::move(name), std::move(system));
+}
+inline std::size_t ecs::scheduler::add_exclusive(std::string name, std::function<void(registry &)> func)
+{
+    System system;
+    system.func = std::move(func);
+    system.exclusive = true;
+    return addSystem(std::move(name), std::move(system));
+}
+template <typename... Include, typename func_t>
+inline std::size_t ecs::scheduler::add_each(std::string name, func_t func)
+{
+    System system;
+    system.func = [func = std::move(func)](registry &registry) {
+        registry.view<std::remove_const_t<Include>...>().each(func);
+    };
+    system.prepare = [](registry &registry) { registry.view<std::remove_const_t<Include>...>(); };
+    ((std::is_const_v<Include> ? system.reads : system.writes).set(impl::ComponentManager::getComponentID<std::remove_const_t<Include>>()), ...);
+    return addSystem(std::move(name), std::move(system));
+}
+inline std::size_t ecs::scheduler::size() const
+{
+    return mSystems.size();
+}
+inline void ecs::scheduler::build()
+{
+    ECS_PROFILE;
+    mWaves.clear();
+    mBefore.assign(mSystems.size(), {});
+    mAfter.assign(mSystems.size(), {});
+    std::vector<std::size_t> waveOf(mSystems.size());
+    for(std::size_t i = 0; i < mSystems.size(); ++i)
+    {
+        std::size_t wave = 0;
+        for(std::size_t before = 0; before < i; ++before)
+        {
+            if(!conflicts(mSystems[before], mSystems[i]))
+                continue;
+            wave = std::max(wave, waveOf[before] + 1);
+            mBefore[i].push_back(before);
+            mAfter[before].push_back(i);
+        }
+        waveOf[i] = wave;
+        if(wave == mWaves.size())
+            mWaves.emplace_back();
+        mWaves[wave].push_back(i);
+    }
+    mDirty = false;
+}
+inline std::vector<std::vector<std::size_t>> const &ecs::scheduler::waves()
+{
+    if(mDirty)
+        build();
+    return mWaves;
+}
+inline ecs::scheduler::Sharing::Sharing(scheduler &scheduler, registry &registry) : shared(registry)
+{
+    for(System const &system : scheduler.mSystems)
+    {
+        if(system.prepare)
+            system.prepare(registry);
+    }
+    shared.mQueriesLocked = true;
+}
+inline ecs::scheduler::Sharing::~Sharing()
+{
+    shared.mQueriesLocked = false;
+}
+inline bool ecs::scheduler::warm() const
+{
+    return std::all_of(mSystems.begin(), mSystems.end(), [](System const &system) { return system.warm; });
+}
+inline void ecs::scheduler::runSystem(std::size_t index, registry &registry)
+{
+    ECS_PROFILE;
+    auto const start = std::chrono::steady_clock::now();
+    mSystems[index].func(registry);
+    system_timing &timing = mTimings[index];
+    timing.last = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    timing.total += timing.last;
+    ++timing.runs;
+    mSystems[index].warm = true;
+}
+template <typename pool_t>
+inline void ecs::scheduler::run(registry &registry, pool_t &pool)
+{
+    ECS_PROFILE;
+    for(auto const &wave : waves())
+    {
+        bool const warm = std::all_of(wave.begin(), wave.end(), [&](std::size_t index) { return mSystems[index].warm; });
+        if(wave.size() == 1 || !warm)
+        {
+            for(std::size_t index : wave)
+                runSystem(index, registry);
+            continue;
+        }
+        Sharing sharing(*this, registry);
+        pool.parallel_for(wave.size(), [&](std::size_t index) { runSystem(wave[index], registry); });
+    }
+}
+inline void ecs::scheduler::run(registry &registry, job_system &jobs)
+{
+    ECS_PROFILE;
+    waves();
+    if(!warm())
+    {
+        run(registry);
+        return;
+    }
+
+    Sharing sharing(*this, registry);
+    struct Node
+    {
+        std::atomic<std::size_t> pending{0}; // unfinished earlier systems
+        std::atomic<bool> skipped{false};
+        job_system::handle handle;
+        std::exception_ptr exception;
+    };
+    std::unique_ptr<Node[]> nodes(new Node[mSystems.size()]);
+    for(std::size_t index = 0; index < mSystems.size(); ++index)
+        nodes[index].pending.store(mBefore[index].size(), std::memory_order_relaxed);
+
+    // a finished system schedules the later ones it was the last to hold back
+    std::function<void(std::size_t)> schedule = [&](std::size_t index) {
+        nodes[index].handle = jobs.run([&, index]() {
+            Node &node = nodes[index];
+            bool const skipped = node.skipped.load(std::memory_order_relaxed);
+            if(!skipped)
+            {
+                try
+                {
+                    runSystem(index, registry);
+                }
+                catch(...)
+                {
+                    node.exception = std::current_exception();
+                }
+            }
+            for(std::size_t after : mAfter[index])
+            {
+                if(skipped || node.exception)
+                    nodes[after].skipped.store(true, std::memory_order_relaxed);
+                if(nodes[after].pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    schedule(after);
+            }
+        });
+    };
+    for(std::size_t index = 0; index < mSystems.size(); ++index)
+    {
+        if(mBefore[index].empty())
+            schedule(index);
+    }
+
+    // the earlier systems are done before a handle is read, and they set it before they finish
+    std::exception_ptr exception;
+    for(std::size_t index = 0; index < mSystems.size(); ++index)
+    {
+        jobs.wait(nodes[index].handle);
+        if(nodes[index].exception && !exception)
+            exception = nodes[index].exception;
+    }
+    if(exception)
+        std::rethrow_exception(exception);
+}
+inline void ecs::scheduler::run(registry &registry)
+{
+    ECS_PROFILE;
+    for(auto const &wave : waves())
+        for(std::size_t index : wave)
+            runSystem(index, registry);
+}
+inline std::vector<ecs::system_timing> const &ecs::scheduler::timings() const
+{
+    return mTimings;
+}
+inline void ecs::scheduler::reset_timings()
+{
+    for(auto &timing : mTimings)
+    {
+        timing.last = timing.total = std::chrono::nanoseconds{0};
+        timing.runs = 0;
+    }
+}
+
+/*! \endcond */
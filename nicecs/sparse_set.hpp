@@ -13,8 +13,11 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #pragma once
 #include <algorithm>
 #include <limits>
+#include <iterator>
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 #ifndef ECS_PROFILE
 #define ECS_PROFILE
@@ -25,6 +28,51 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 namespace ecs
 {
+    /// @brief Whether an object can be moved to another address with memcpy, leaving the source without destroying it.
+    /// Containers relocate such elements with bulk memory operations.
+    /// True for trivially copyable types by default. Specialize it for types that only hold owning pointers (std::unique_ptr, std::vector, etc.).
+    template<typename type_t>
+    struct is_trivially_relocatable : std::is_trivially_copyable<type_t> {};
+
+    /// @copydoc is_trivially_relocatable
+    template<typename type_t>
+    constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<type_t>::value;
+
+    /// @brief Memory used by a container, in bytes.
+    /// Memory owned by the elements themselves (e.g. std::string contents) is not counted.
+    struct memory_stats
+    {
+        /// @brief Number of stored elements.
+        std::size_t elements = 0;
+        /// @brief Bytes allocated for the elements.
+        std::size_t denseBytes = 0;
+        /// @brief Bytes allocated for the keys (dense to sparse mapping).
+        std::size_t keyBytes = 0;
+        /// @brief Bytes allocated for the sparse index.
+        std::size_t sparseBytes = 0;
+        /// @brief Number of allocated sparse pages.
+        std::size_t sparsePages = 0;
+        /// @brief Number of slots in the allocated sparse pages. Slots holding an element are occupied, the rest are wasted.
+        std::size_t sparseSlots = 0;
+        /// @brief Allocated bytes that do not hold live data (spare capacity, unoccupied sparse slots).
+        std::size_t wastedBytes = 0;
+
+        /// @brief Get the total number of allocated bytes.
+        inline std::size_t total() const { return denseBytes + keyBytes + sparseBytes; }
+
+        inline memory_stats &operator+=(memory_stats const &other)
+        {
+            elements += other.elements;
+            denseBytes += other.denseBytes;
+            keyBytes += other.keyBytes;
+            sparseBytes += other.sparseBytes;
+            sparsePages += other.sparsePages;
+            sparseSlots += other.sparseSlots;
+            wastedBytes += other.wastedBytes;
+            return *this;
+        }
+    };
+
     /// @brief A sparse set implementation.
     /// @tparam dense_t The type of densely stored data.
     template<typename dense_t, typename allocator_t = std::allocator<dense_t>>
@@ -105,6 +153,23 @@ namespace ecs
         /// @return The index of the element, null if container doesent contain @p sparse.
         index_type getDenseIndex(sparse_type const &sparse) const;
 
+        /// @brief Swap the positions of two elements in the dense list.
+        /// The elements stay at their sparse indices.
+        /// @param lhs A sparse index.
+        /// @param rhs A sparse index.
+        /// @throws std::out_of_range If a sparse index doesent contain the element.
+        void swapDense(sparse_type const &lhs, sparse_type const &rhs);
+
+        /// @brief Exchange the dense list with another list of the same size, in O(1).
+        /// The elements take the places of the old ones, the sparse indices are kept.
+        /// @param dense The list to exchange with.
+        void exchangeDense(std::vector<dense_type, allocator_type> &dense);
+
+        /// @brief Move every element of another sparse set to the end of the dense list, and clear it.
+        /// Faster than emplacing them one by one.
+        /// @param other A sparse set with no sparse index in common with this one.
+        void append(sparse_set &&other);
+
         /// @brief Check whether the sparse set contains an element at a given sparse index.
         /// @param sparse A sparse index.
         /// @return True if found, false otherwise.
@@ -116,6 +181,10 @@ namespace ecs
         /// @brief Sets the capacity to the size.
         void shrink_to_fit();
 
+        /// @brief Get the memory used by the container.
+        /// Takes time proportional to the number of sparse pages.
+        memory_stats memory_usage() const;
+
         /// @return True if the container is empty, false otherwise.
         bool empty() const;
 
@@ -233,17 +302,13 @@ template <typename dense_t, typename allocator_t>
 inline ecs::sparse_set<dense_t, allocator_t> &ecs::sparse_set<dense_t, allocator_t>::operator=(sparse_set const &other)
 {
     ECS_PROFILE;
+    if(this == &other)
+        return *this;
+    // copy assignment reuses the allocated buffers and copies trivially copyable elements with memmove
+    mPageSize = other.mPageSize;
     mDense = other.mDense;
     mDenseToSparse = other.mDenseToSparse;
-    
-    mSparse.clear();
-    for(auto const &otherPage : other.mSparse)
-    {
-        if(!otherPage.empty())
-            mSparse.emplace_back(otherPage);
-        else
-            mSparse.emplace_back();
-    }
+    mSparse = other.mSparse;
 
     return *this;
 }
@@ -254,6 +319,7 @@ inline ecs::sparse_set<dense_t, allocator_t> &ecs::sparse_set<dense_t, allocator
     std::swap(mDense, other.mDense);
     std::swap(mDenseToSparse, other.mDenseToSparse);
     std::swap(mSparse, other.mSparse);
+    std::swap(mPageSize, other.mPageSize);
     
     return *this;
 }
@@ -288,7 +354,22 @@ inline void ecs::sparse_set<dense_t, allocator_t>::erase(sparse_type const &spar
         setDenseIndex(lastSparseIndex, removedDenseIndex);
 
         mDenseToSparse[removedDenseIndex] = lastSparseIndex;
-        mDense[removedDenseIndex] = std::move(mDense[lastDenseIndex]);
+        if constexpr(std::is_trivially_copyable_v<dense_type>)
+        {
+            std::memcpy(static_cast<void *>(&mDense[removedDenseIndex]), &mDense[lastDenseIndex], sizeof(dense_type));
+        }
+        else if constexpr(is_trivially_relocatable_v<dense_type>)
+        {
+            // swap the bytes, so that pop_back destroys the removed element
+            alignas(dense_type) unsigned char removed[sizeof(dense_type)];
+            std::memcpy(removed, static_cast<void *>(&mDense[removedDenseIndex]), sizeof(dense_type));
+            std::memcpy(static_cast<void *>(&mDense[removedDenseIndex]), static_cast<void *>(&mDense[lastDenseIndex]), sizeof(dense_type));
+            std::memcpy(static_cast<void *>(&mDense[lastDenseIndex]), removed, sizeof(dense_type));
+        }
+        else
+        {
+            mDense[removedDenseIndex] = std::move(mDense[lastDenseIndex]);
+        }
     }
 
     setDenseIndex(sparse, null);
@@ -297,6 +378,48 @@ inline void ecs::sparse_set<dense_t, allocator_t>::erase(sparse_type const &spar
     mDenseToSparse.pop_back();
 }
 template <typename dense_t, typename allocator_t>
+inline void ecs::sparse_set<dense_t, allocator_t>::swapDense(sparse_type const &lhs, sparse_type const &rhs)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(getDenseIndex(lhs) != null && getDenseIndex(rhs) != null, "Swapping a non-existing element of a sparse index");
+
+    index_type lhsIndex = getDenseIndex(lhs);
+    index_type rhsIndex = getDenseIndex(rhs);
+    if(lhsIndex == rhsIndex)
+        return;
+
+    using std::swap;
+    swap(mDense[lhsIndex], mDense[rhsIndex]);
+    mDenseToSparse[lhsIndex] = rhs;
+    mDenseToSparse[rhsIndex] = lhs;
+    setDenseIndex(lhs, rhsIndex);
+    setDenseIndex(rhs, lhsIndex);
+}
+template <typename dense_t, typename allocator_t>
+inline void ecs::sparse_set<dense_t, allocator_t>::exchangeDense(std::vector<dense_type, allocator_type> &dense)
+{
+    ECS_ASSERT(dense.size() == mDense.size(), "Exchanging dense lists of different sizes");
+    mDense.swap(dense);
+}
+template <typename dense_t, typename allocator_t>
+inline void ecs::sparse_set<dense_t, allocator_t>::append(sparse_set &&other)
+{
+    ECS_PROFILE;
+    std::size_t const base = mDense.size();
+    mDense.insert(mDense.end(), std::make_move_iterator(other.mDense.begin()), std::make_move_iterator(other.mDense.end()));
+    mDenseToSparse.insert(mDenseToSparse.end(), other.mDenseToSparse.begin(), other.mDenseToSparse.end());
+    for(std::size_t index = base; index < mDenseToSparse.size(); ++index)
+    {
+        ECS_ASSERT(getDenseIndex(mDenseToSparse[index]) == null, "Element added to the same sparse index more than once");
+        setDenseIndex(mDenseToSparse[index], static_cast<index_type>(index));
+    }
+    // keep the pages of other, it is usually filled again
+    for(sparse_type const &sparse : other.mDenseToSparse)
+        other.setDenseIndex(sparse, null);
+    other.mDense.clear();
+    other.mDenseToSparse.clear();
+}
+template <typename dense_t, typename allocator_t>
 inline bool ecs::sparse_set<dense_t, allocator_t>::contains(sparse_type const &sparse) const
 {
     ECS_PROFILE;
@@ -323,6 +446,30 @@ inline void ecs::sparse_set<dense_t, allocator_t>::shrink_to_fit()
     mSparse.shrink_to_fit();
 }
 template <typename dense_t, typename allocator_t>
+inline ecs::memory_stats ecs::sparse_set<dense_t, allocator_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    memory_stats stats;
+    stats.elements = mDense.size();
+    stats.denseBytes = mDense.capacity() * sizeof(dense_type);
+    stats.keyBytes = mDenseToSparse.capacity() * sizeof(sparse_type);
+    stats.sparseBytes = mSparse.capacity() * sizeof(std::vector<index_type>);
+    for(auto const &page : mSparse)
+    {
+        if(page.empty())
+            continue;
+        ++stats.sparsePages;
+        stats.sparseSlots += page.size();
+        stats.sparseBytes += page.capacity() * sizeof(index_type);
+    }
+    stats.wastedBytes = 
+        (mDense.capacity() - mDense.size()) * sizeof(dense_type) + 
+        (mDenseToSparse.capacity() - mDenseToSparse.size()) * sizeof(sparse_type) + 
+        (stats.sparseSlots - mDense.size()) * sizeof(index_type) + 
+        (mSparse.capacity() - stats.sparsePages) * sizeof(std::vector<index_type>);
+    return stats;
+}
+template <typename dense_t, typename allocator_t>
 inline typename ecs::sparse_set<dense_t, allocator_t>::dense_type const &ecs::sparse_set<dense_t, allocator_t>::get(sparse_type const &sparse) const
 {
     ECS_PROFILE;
@@ -0,0 +1,1157 @@
+/*
+      ___  ___ ___
+     / _ \/ __/ __|        Copyright (c) 2024 Nikita Martynau
+    |  __/ (__\__ \        https://opensource.org/license/mit
+     \___|\___|___/ v1.5.8 https://github.com/nikitawew/nicecs
+
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include <deque>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <type_traits>
+#include <cstring>
+#include <functional>
+
+#include "sparse_set.hpp"
+
+namespace ecs
+{
+namespace impl
+{
+    /// @brief True if the value is constructed with braces from the arguments (aggregate initialization).
+    template<typename value_t, class... Args>
+    constexpr bool isBraceInitialized = std::is_aggregate_v<value_t> && (sizeof...(Args) != 0u || !std::is_default_constructible_v<value_t>);
+
+    /// @brief Constructs an element at the end of a vector. Aggregates are brace-initialized.
+    template<typename vector_t, class... Args>
+    void emplaceBack(vector_t &vector, Args&&... args);
+
+    /// @brief Constructs an object in an optional. Aggregates are brace-initialized.
+    template<typename value_t, class... Args>
+    void emplaceOptional(std::optional<value_t> &optional, Args&&... args);
+} // namespace impl
+
+    /// @brief Selects the storage engine of a component type.
+    /// Specialize it to change the way a component is stored:
+    /// @code
+    /// template<> struct ecs::storage_traits<Boss> { using storage_type = ecs::hash_storage<Boss>; };
+    /// @endcode
+    /// A storage engine is a copyable class with the following members (see ecs::sparse_set):
+    /// sparse_type, dense_type, emplace, erase, get, contains, sparse, size, empty, clear.
+    /// The specialization must be visible before the component is first used with a registry.
+    /// @tparam component_t The component type.
+    template<typename component_t, typename = void>
+    struct storage_traits
+    {
+        /// @brief The storage engine. Paged sparse set by default.
+        using storage_type = sparse_set<component_t>;
+    };
+
+    /// @brief The reference to a component that a non-const registry gives out, the one returned by get of its storage engine.
+    /// Const for the engines that share elements between entities (ecs::shared_storage), which are written with their own members.
+    /// @tparam component_t The component type.
+    template<typename component_t>
+    using storage_reference = decltype(std::declval<typename storage_traits<component_t>::storage_type &>().get(std::declval<typename storage_traits<component_t>::storage_type::sparse_type const &>()));
+
+    /// @brief A sparse set with a hashed sparse index.
+    /// Only costs memory for the stored elements. Use for rare components attached to entities with large identifiers.
+    /// @tparam dense_t The type of densely stored data.
+    template<typename dense_t>
+    class hash_storage
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+        /// @copydoc sparse_set::index_type
+        using index_type = std::uint32_t;
+    private:
+        std::vector<dense_type> mDense;
+        std::vector<sparse_type> mDenseToSparse;
+        std::unordered_map<sparse_type, index_type> mIndex;
+    public:
+        /// @param capacity The optional capacity to reserve.
+        hash_storage(std::size_t capacity = 0);
+
+        /// @copydoc sparse_set::emplace
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @copydoc sparse_set::get
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::get
+        dense_type &get(sparse_type const &sparse);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::dense
+        std::vector<dense_type> const &dense() const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::reserve
+        void reserve(std::size_t newCapacity);
+        /// @copydoc sparse_set::shrink_to_fit
+        void shrink_to_fit();
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+    };
+
+    /// @brief A storage that never moves its elements.
+    /// References to the stored elements remain valid until the element is erased.
+    /// @tparam dense_t The type of stored data.
+    template<typename dense_t>
+    class stable_storage
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+        /// @copydoc sparse_set::index_type
+        using index_type = std::uint32_t;
+    private:
+        std::deque<std::optional<dense_type>> mSlots;
+        std::vector<index_type> mFreeSlots;
+        sparse_set<index_type> mIndex;
+    public:
+        stable_storage() = default;
+
+        /// @copydoc sparse_set::emplace
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @copydoc sparse_set::get
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::get
+        dense_type &get(sparse_type const &sparse);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+    };
+
+    /// @brief A sparse set of heap allocated elements.
+    /// Keeps the dense list small for huge components, that are rarely iterated.
+    /// @tparam dense_t The type of stored data.
+    template<typename dense_t>
+    class boxed_storage
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+    private:
+        /// @brief Deep copying owning pointer.
+        struct box
+        {
+            std::unique_ptr<dense_type> value;
+
+            box() = default;
+            box(box &&) noexcept = default;
+            box &operator=(box &&) noexcept = default;
+            inline box(box const &other) : value(other.value ? std::make_unique<dense_type>(*other.value) : nullptr) {}
+            inline box &operator=(box const &other) { value = other.value ? std::make_unique<dense_type>(*other.value) : nullptr; return *this; }
+        };
+        sparse_set<box> mBoxes;
+    public:
+        boxed_storage() = default;
+
+        /// @copydoc sparse_set::emplace
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @copydoc sparse_set::get
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::get
+        dense_type &get(sparse_type const &sparse);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+    };
+
+    /// @brief Hashes a shared component. Types whose equal values have the same bytes (std::has_unique_object_representations) are hashed bytewise, others with std::hash.
+    /// @tparam value_t The component type.
+    template<typename value_t>
+    struct shared_hash
+    {
+        std::size_t operator()(value_t const &value) const;
+    };
+
+    /// @brief Compares shared components. Types whose equal values have the same bytes (std::has_unique_object_representations) are compared bytewise, others with operator==.
+    /// Padding and floating point members (where -0.0 equals 0.0) rule out the bytewise comparison.
+    /// @tparam value_t The component type.
+    template<typename value_t>
+    struct shared_equal
+    {
+        bool operator()(value_t const &lhs, value_t const &rhs) const;
+    };
+
+    /// @brief A storage of deduplicated (flyweight) elements.
+    /// Equal elements are stored once and referenced by every sparse index that holds them.
+    /// get only reads, so iterating a non-const registry keeps the elements shared.
+    /// write copies a shared element first (copy on write), the copy is not shared until replace is called.
+    /// @tparam dense_t The type of stored data.
+    /// @tparam hash_t The hash function of the stored data.
+    /// @tparam equal_t The equality function of the stored data.
+    template<typename dense_t, typename hash_t = shared_hash<dense_t>, typename equal_t = shared_equal<dense_t>>
+    class shared_storage
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+        /// @copydoc sparse_set::index_type
+        using index_type = std::uint32_t;
+    private:
+        std::vector<std::optional<dense_type>> mValues;
+        std::vector<index_type> mReferences;
+        std::vector<std::size_t> mHashes;
+        std::vector<bool> mInterned;
+        std::vector<index_type> mFreeSlots;
+        std::unordered_multimap<std::size_t, index_type> mLookup;
+        sparse_set<index_type> mSlots;
+
+        index_type newSlot();
+        void unintern(index_type slot);
+        void release(index_type slot);
+        index_type intern(dense_type &&value);
+        index_type detach(sparse_type const &sparse);
+    public:
+        shared_storage() = default;
+
+        /// @copydoc sparse_set::emplace
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @brief Gets an element at a sparse index for reading, also through a non-const storage.
+        /// @param sparse A sparse index.
+        /// @return An element const lvalue reference, possibly shared with other indices.
+        /// @throws std::out_of_range If a sparse index doesent contain the element.
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @brief Gets an element at a sparse index for writing.
+        /// If the element is shared, it is copied first.
+        /// @param sparse A sparse index.
+        /// @return An element lvalue reference, not shared with the other indices.
+        /// @throws std::out_of_range If a sparse index doesent contain the element.
+        dense_type &write(sparse_type const &sparse);
+        /// @brief Replaces an element at a sparse index with an interned value.
+        /// @param sparse A sparse index.
+        /// @param args Arguments forwarded to construct the new element.
+        /// @throws std::out_of_range If a sparse index doesent contain the element.
+        template <class... Args>
+        void replace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+
+        /// @brief Get the number of distinct stored values.
+        std::size_t distinct() const;
+
+        /// @brief Check whether the element at a sparse index is referenced by other indices.
+        /// @param sparse A sparse index.
+        bool shared(sparse_type const &sparse) const;
+
+        /// @brief Calls a function once for every distinct value.
+        /// @param func Called as func(value, ownersBegin, ownersEnd), where [ownersBegin; ownersEnd) are the sparse indices referencing the value.
+        template <typename func_t>
+        void each_value(func_t &&func) const;
+    };
+
+    /// @brief A storage with a single slot.
+    /// At most one sparse index can hold an element at a time. Use for global components.
+    /// @tparam dense_t The type of stored data.
+    template<typename dense_t>
+    class singleton_storage
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+    private:
+        std::optional<dense_type> mValue;
+        std::vector<sparse_type> mOwner;
+    public:
+        singleton_storage() = default;
+
+        /// @copydoc sparse_set::emplace
+        /// @throws std::invalid_argument If the slot is already taken.
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @copydoc sparse_set::get
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::get
+        dense_type &get(sparse_type const &sparse);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+
+        /// @brief Gets the stored element without knowing its owner.
+        /// @throws std::out_of_range If the storage is empty.
+        dense_type &value();
+        /// @copydoc value
+        dense_type const &value() const;
+    };
+
+    /// @brief A storage holding two copies of every element: the current one, read by the systems, and the next one, written by them.
+    /// Readers never see partially updated values, so the readers and the writers can run in parallel without locks.
+    /// Both buffers share one sparse index, swap makes the next buffer current in O(1).
+    /// The element type must be copyable, a new element starts with the same value in both buffers.
+    /// After a swap the next buffer holds the values from before the last step, so a writer must write every element each step, or copy the current value of the elements it skips.
+    /// Otherwise the skipped elements go back to their older value at the next swap.
+    /// Take the read and write handles again after every swap, the ones taken before point to the other buffer.
+    /// @code
+    /// auto &boids = registry.storage<Boid>();
+    /// auto previous = boids.read();
+    /// auto next = boids.write();
+    /// for(auto entity : registry.view<Boid>()) next.get(entity) = steer(previous, entity);
+    /// boids.swap();
+    /// @endcode
+    /// @tparam dense_t The type of stored data.
+    template<typename dense_t>
+    class double_buffered
+    {
+    public:
+        /// @copydoc sparse_set::sparse_type
+        using sparse_type = std::size_t;
+        /// @copydoc sparse_set::dense_type
+        using dense_type = dense_t;
+
+        /// @brief One of the buffers, indexed like the storage. Invalidated when an element is added or erased, and by swap, after which it points to the other buffer.
+        /// @tparam value_t dense_type for the next buffer, dense_type const for the current one.
+        template<typename value_t>
+        class buffer
+        {
+        private:
+            sparse_set<dense_type> const *mIndex;
+            value_t *mData;
+        public:
+            inline buffer(sparse_set<dense_type> const &index, value_t *data) : mIndex(&index), mData(data) {}
+
+            /// @brief Gets the element of a sparse index in this buffer.
+            /// @throws std::out_of_range If a sparse index doesent contain the element.
+            value_t &get(sparse_type const &sparse) const;
+            /// @copydoc sparse_set::contains
+            inline bool contains(sparse_type const &sparse) const { return mIndex->contains(sparse); }
+            /// @brief Get the elements, 1 to 1 with sparse.
+            inline value_t *data() const { return mData; }
+            /// @copydoc sparse_set::sparse
+            inline std::vector<sparse_type> const &sparse() const { return mIndex->sparse(); }
+            /// @copydoc sparse_set::size
+            inline std::size_t size() const { return mIndex->size(); }
+            inline value_t *begin() const { return mData; }
+            inline value_t *end() const { return mData + mIndex->size(); }
+        };
+    private:
+        sparse_set<dense_type> mCurrent; // the current buffer and the sparse index
+        std::vector<dense_type> mNext; // 1 to 1 with the dense list of mCurrent
+    public:
+        double_buffered() = default;
+
+        /// @copydoc sparse_set::emplace
+        template <class... Args>
+        void emplace(sparse_type const &sparse, Args&&... args);
+        /// @copydoc sparse_set::erase
+        void erase(sparse_type const &sparse);
+        /// @brief Copy both buffers of an element of another storage, so that the copy keeps its next value.
+        /// @param sparse A sparse index of this storage, that contains the element.
+        /// @param other The storage to copy from.
+        /// @param from A sparse index of @p other, that contains the element.
+        void copy(sparse_type const &sparse, double_buffered const &other, sparse_type const &from);
+        /// @brief Gets the current element of a sparse index.
+        /// @throws std::out_of_range If a sparse index doesent contain the element.
+        dense_type const &get(sparse_type const &sparse) const;
+        /// @copydoc get
+        /// Writes are seen by the readers of the current buffer right away, use write to prepare the next value.
+        dense_type &get(sparse_type const &sparse);
+        /// @copydoc sparse_set::contains
+        bool contains(sparse_type const &sparse) const;
+        /// @copydoc sparse_set::sparse
+        std::vector<sparse_type> const &sparse() const;
+        /// @copydoc sparse_set::empty
+        bool empty() const;
+        /// @copydoc sparse_set::size
+        std::size_t size() const;
+        /// @copydoc sparse_set::clear
+        void clear();
+        /// @copydoc sparse_set::memory_usage
+        memory_stats memory_usage() const;
+
+        /// @brief Get the current buffer.
+        buffer<dense_type const> read() const;
+        /// @brief Get the next buffer.
+        /// Until it is written, an element holds its value from before the last swap, the one that becomes current again at the next swap.
+        buffer<dense_type> write();
+        /// @brief Make the next buffer current, in O(1). The current buffer becomes the next one.
+        /// Invalidates the buffers returned by read and write: the data under them is exchanged.
+        void swap();
+    };
+} // namespace ecs
+
+
+template<typename vector_t, class... Args>
+inline void ecs::impl::emplaceBack(vector_t &vector, Args&&... args)
+{
+    using value_type = typename vector_t::value_type;
+    if constexpr(isBraceInitialized<value_type, Args...>)
+        vector.emplace_back(value_type{std::forward<Args>(args)...});
+    else
+        vector.emplace_back(std::forward<Args>(args)...);
+}
+template<typename value_t, class... Args>
+inline void ecs::impl::emplaceOptional(std::optional<value_t> &optional, Args&&... args)
+{
+    if constexpr(isBraceInitialized<value_t, Args...>)
+        optional.emplace(value_t{std::forward<Args>(args)...});
+    else
+        optional.emplace(std::forward<Args>(args)...);
+}
+
+template <typename dense_t>
+inline ecs::hash_storage<dense_t>::hash_storage(std::size_t capacity)
+{
+    reserve(capacity);
+}
+template <typename dense_t>
+template <class... Args>
+inline void ecs::hash_storage<dense_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(!contains(sparse), "Element added to the same sparse index more than once");
+
+    impl::emplaceBack(mDense, std::forward<Args>(args)...);
+    mDenseToSparse.emplace_back(sparse);
+    mIndex.emplace(sparse, static_cast<index_type>(mDense.size() - 1));
+}
+template <typename dense_t>
+inline void ecs::hash_storage<dense_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Removing a non-existing element from a sparse index");
+
+    auto removed = mIndex.find(sparse);
+    index_type removedDenseIndex = removed->second;
+    index_type lastDenseIndex = static_cast<index_type>(mDense.size() - 1);
+
+    if(removedDenseIndex != lastDenseIndex)
+    {
+        sparse_type lastSparseIndex = mDenseToSparse[lastDenseIndex];
+        mIndex[lastSparseIndex] = removedDenseIndex;
+
+        mDenseToSparse[removedDenseIndex] = lastSparseIndex;
+        mDense[removedDenseIndex] = std::move(mDense[lastDenseIndex]);
+    }
+
+    mIndex.erase(removed);
+    mDense.pop_back();
+    mDenseToSparse.pop_back();
+}
+template <typename dense_t>
+inline typename ecs::hash_storage<dense_t>::dense_type const &ecs::hash_storage<dense_t>::get(sparse_type const &sparse) const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return mDense[mIndex.find(sparse)->second];
+}
+template <typename dense_t>
+inline typename ecs::hash_storage<dense_t>::dense_type &ecs::hash_storage<dense_t>::get(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return mDense[mIndex.find(sparse)->second];
+}
+template <typename dense_t>
+inline bool ecs::hash_storage<dense_t>::contains(sparse_type const &sparse) const
+{
+    return mIndex.find(sparse) != mIndex.end();
+}
+template <typename dense_t>
+inline std::vector<typename ecs::hash_storage<dense_t>::dense_type> const &ecs::hash_storage<dense_t>::dense() const
+{
+    return mDense;
+}
+template <typename dense_t>
+inline std::vector<typename ecs::hash_storage<dense_t>::sparse_type> const &ecs::hash_storage<dense_t>::sparse() const
+{
+    return mDenseToSparse;
+}
+template <typename dense_t>
+inline void ecs::hash_storage<dense_t>::reserve(std::size_t newCapacity)
+{
+    ECS_PROFILE;
+    mDense.reserve(newCapacity);
+    mDenseToSparse.reserve(newCapacity);
+    mIndex.reserve(newCapacity);
+}
+template <typename dense_t>
+inline void ecs::hash_storage<dense_t>::shrink_to_fit()
+{
+    ECS_PROFILE;
+    mDense.shrink_to_fit();
+    mDenseToSparse.shrink_to_fit();
+    mIndex.rehash(0);
+}
+template <typename dense_t>
+inline bool ecs::hash_storage<dense_t>::empty() const
+{
+    return mDense.empty();
+}
+template <typename dense_t>
+inline std::size_t ecs::hash_storage<dense_t>::size() const
+{
+    return mDense.size();
+}
+template <typename dense_t>
+inline void ecs::hash_storage<dense_t>::clear()
+{
+    ECS_PROFILE;
+    mDense.clear();
+    mDenseToSparse.clear();
+    mIndex.clear();
+}
+
+template <typename dense_t>
+template <class... Args>
+inline void ecs::stable_storage<dense_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(!contains(sparse), "Element added to the same sparse index more than once");
+
+    index_type slot = 0;
+    if(mFreeSlots.empty())
+    {
+        slot = static_cast<index_type>(mSlots.size());
+        mSlots.emplace_back();
+    } else {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    }
+    impl::emplaceOptional(mSlots[slot], std::forward<Args>(args)...);
+    mIndex.emplace(sparse, slot);
+}
+template <typename dense_t>
+inline void ecs::stable_storage<dense_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Removing a non-existing element from a sparse index");
+
+    index_type slot = mIndex.get(sparse);
+    mSlots[slot].reset();
+    mFreeSlots.push_back(slot);
+    mIndex.erase(sparse);
+}
+template <typename dense_t>
+inline typename ecs::stable_storage<dense_t>::dense_type const &ecs::stable_storage<dense_t>::get(sparse_type const &sparse) const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mSlots[mIndex.get(sparse)];
+}
+template <typename dense_t>
+inline typename ecs::stable_storage<dense_t>::dense_type &ecs::stable_storage<dense_t>::get(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mSlots[mIndex.get(sparse)];
+}
+template <typename dense_t>
+inline bool ecs::stable_storage<dense_t>::contains(sparse_type const &sparse) const
+{
+    return mIndex.contains(sparse);
+}
+template <typename dense_t>
+inline std::vector<typename ecs::stable_storage<dense_t>::sparse_type> const &ecs::stable_storage<dense_t>::sparse() const
+{
+    return mIndex.sparse();
+}
+template <typename dense_t>
+inline bool ecs::stable_storage<dense_t>::empty() const
+{
+    return mIndex.empty();
+}
+template <typename dense_t>
+inline std::size_t ecs::stable_storage<dense_t>::size() const
+{
+    return mIndex.size();
+}
+template <typename dense_t>
+inline void ecs::stable_storage<dense_t>::clear()
+{
+    ECS_PROFILE;
+    mSlots.clear();
+    mFreeSlots.clear();
+    mIndex.clear();
+}
+
+template <typename dense_t>
+template <class... Args>
+inline void ecs::boxed_storage<dense_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(!contains(sparse), "Element added to the same sparse index more than once");
+
+    box element;
+    if constexpr(impl::isBraceInitialized<dense_type, Args...>)
+        element.value.reset(new dense_type{std::forward<Args>(args)...});
+    else
+        element.value = std::make_unique<dense_type>(std::forward<Args>(args)...);
+    mBoxes.emplace(sparse, std::move(element));
+}
+template <typename dense_t>
+inline void ecs::boxed_storage<dense_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    mBoxes.erase(sparse);
+}
+template <typename dense_t>
+inline typename ecs::boxed_storage<dense_t>::dense_type const &ecs::boxed_storage<dense_t>::get(sparse_type const &sparse) const
+{
+    ECS_PROFILE;
+    return *mBoxes.get(sparse).value;
+}
+template <typename dense_t>
+inline typename ecs::boxed_storage<dense_t>::dense_type &ecs::boxed_storage<dense_t>::get(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    return *mBoxes.get(sparse).value;
+}
+template <typename dense_t>
+inline bool ecs::boxed_storage<dense_t>::contains(sparse_type const &sparse) const
+{
+    return mBoxes.contains(sparse);
+}
+template <typename dense_t>
+inline std::vector<typename ecs::boxed_storage<dense_t>::sparse_type> const &ecs::boxed_storage<dense_t>::sparse() const
+{
+    return mBoxes.sparse();
+}
+template <typename dense_t>
+inline bool ecs::boxed_storage<dense_t>::empty() const
+{
+    return mBoxes.empty();
+}
+template <typename dense_t>
+inline std::size_t ecs::boxed_storage<dense_t>::size() const
+{
+    return mBoxes.size();
+}
+template <typename dense_t>
+inline void ecs::boxed_storage<dense_t>::clear()
+{
+    ECS_PROFILE;
+    mBoxes.clear();
+}
+
+template <typename dense_t>
+template <class... Args>
+inline void ecs::singleton_storage<dense_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(!contains(sparse), "Element added to the same sparse index more than once");
+    ECS_ASSERT(!mValue.has_value(), "Singleton component added to more than one entity");
+
+    impl::emplaceOptional(mValue, std::forward<Args>(args)...);
+    mOwner.assign(1, sparse);
+}
+template <typename dense_t>
+inline void ecs::singleton_storage<dense_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Removing a non-existing element from a sparse index");
+    mValue.reset();
+    mOwner.clear();
+}
+template <typename dense_t>
+inline typename ecs::singleton_storage<dense_t>::dense_type const &ecs::singleton_storage<dense_t>::get(sparse_type const &sparse) const
+{
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mValue;
+}
+template <typename dense_t>
+inline typename ecs::singleton_storage<dense_t>::dense_type &ecs::singleton_storage<dense_t>::get(sparse_type const &sparse)
+{
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mValue;
+}
+template <typename dense_t>
+inline bool ecs::singleton_storage<dense_t>::contains(sparse_type const &sparse) const
+{
+    return !mOwner.empty() && mOwner.front() == sparse;
+}
+template <typename dense_t>
+inline std::vector<typename ecs::singleton_storage<dense_t>::sparse_type> const &ecs::singleton_storage<dense_t>::sparse() const
+{
+    return mOwner;
+}
+template <typename dense_t>
+inline bool ecs::singleton_storage<dense_t>::empty() const
+{
+    return mOwner.empty();
+}
+template <typename dense_t>
+inline std::size_t ecs::singleton_storage<dense_t>::size() const
+{
+    return mOwner.size();
+}
+template <typename dense_t>
+inline void ecs::singleton_storage<dense_t>::clear()
+{
+    mValue.reset();
+    mOwner.clear();
+}
+template <typename dense_t>
+inline typename ecs::singleton_storage<dense_t>::dense_type &ecs::singleton_storage<dense_t>::value()
+{
+    ECS_ASSERT(mValue.has_value(), "Getting a value from an empty singleton storage");
+    return *mValue;
+}
+template <typename dense_t>
+inline typename ecs::singleton_storage<dense_t>::dense_type const &ecs::singleton_storage<dense_t>::value() const
+{
+    ECS_ASSERT(mValue.has_value(), "Getting a value from an empty singleton storage");
+    return *mValue;
+}
+
+template <typename value_t>
+inline std::size_t ecs::shared_hash<value_t>::operator()(value_t const &value) const
+{
+    if constexpr(std::has_unique_object_representations_v<value_t>)
+    {
+        // FNV-1a
+        std::size_t hash = 14695981039346656037ull;
+        auto bytes = reinterpret_cast<unsigned char const *>(&value);
+        for(std::size_t i = 0; i < sizeof(value_t); ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+    else
+        return std::hash<value_t>{}(value);
+}
+template <typename value_t>
+inline bool ecs::shared_equal<value_t>::operator()(value_t const &lhs, value_t const &rhs) const
+{
+    if constexpr(std::has_unique_object_representations_v<value_t>)
+        return std::memcmp(&lhs, &rhs, sizeof(value_t)) == 0;
+    else
+        return lhs == rhs;
+}
+
+template <typename dense_t, typename hash_t, typename equal_t>
+inline typename ecs::shared_storage<dense_t, hash_t, equal_t>::index_type ecs::shared_storage<dense_t, hash_t, equal_t>::newSlot()
+{
+    if(!mFreeSlots.empty())
+    {
+        index_type slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        return slot;
+    }
+    mValues.emplace_back();
+    mReferences.emplace_back(0);
+    mHashes.emplace_back(0);
+    mInterned.emplace_back(false);
+    return static_cast<index_type>(mValues.size() - 1);
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::unintern(index_type slot)
+{
+    if(!mInterned[slot])
+        return;
+
+    auto [begin, end] = mLookup.equal_range(mHashes[slot]);
+    for(auto it = begin; it != end; ++it)
+    {
+        if(it->second == slot)
+        {
+            mLookup.erase(it);
+            break;
+        }
+    }
+    mInterned[slot] = false;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::release(index_type slot)
+{
+    if(--mReferences[slot] != 0)
+        return;
+
+    unintern(slot);
+    mValues[slot].reset();
+    mFreeSlots.push_back(slot);
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline typename ecs::shared_storage<dense_t, hash_t, equal_t>::index_type ecs::shared_storage<dense_t, hash_t, equal_t>::intern(dense_type &&value)
+{
+    ECS_PROFILE;
+    std::size_t hash = hash_t{}(value);
+    auto [begin, end] = mLookup.equal_range(hash);
+    for(auto it = begin; it != end; ++it)
+    {
+        if(equal_t{}(*mValues[it->second], value))
+        {
+            ++mReferences[it->second];
+            return it->second;
+        }
+    }
+
+    index_type slot = newSlot();
+    mValues[slot].emplace(std::move(value));
+    mReferences[slot] = 1;
+    mHashes[slot] = hash;
+    mInterned[slot] = true;
+    mLookup.emplace(hash, slot);
+    return slot;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline typename ecs::shared_storage<dense_t, hash_t, equal_t>::index_type ecs::shared_storage<dense_t, hash_t, equal_t>::detach(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    index_type slot = mSlots.get(sparse);
+    if(mReferences[slot] == 1)
+    {
+        // the only owner, the value may change, so it can not be found by value anymore
+        unintern(slot);
+        return slot;
+    }
+
+    index_type copy = newSlot();
+    mValues[copy].emplace(*mValues[slot]);
+    mReferences[copy] = 1;
+    release(slot);
+    mSlots.get(sparse) = copy;
+    return copy;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+template <class... Args>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(!contains(sparse), "Element added to the same sparse index more than once");
+
+    std::optional<dense_type> value;
+    impl::emplaceOptional(value, std::forward<Args>(args)...);
+    mSlots.emplace(sparse, intern(std::move(*value)));
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+template <class... Args>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::replace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Replacing a non-existing element at a sparse index");
+
+    std::optional<dense_type> value;
+    impl::emplaceOptional(value, std::forward<Args>(args)...);
+    index_type slot = intern(std::move(*value));
+    release(mSlots.get(sparse));
+    mSlots.get(sparse) = slot;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Removing a non-existing element from a sparse index");
+
+    release(mSlots.get(sparse));
+    mSlots.erase(sparse);
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline typename ecs::shared_storage<dense_t, hash_t, equal_t>::dense_type const &ecs::shared_storage<dense_t, hash_t, equal_t>::get(sparse_type const &sparse) const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mValues[mSlots.get(sparse)];
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline typename ecs::shared_storage<dense_t, hash_t, equal_t>::dense_type &ecs::shared_storage<dense_t, hash_t, equal_t>::write(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return *mValues[detach(sparse)];
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline bool ecs::shared_storage<dense_t, hash_t, equal_t>::contains(sparse_type const &sparse) const
+{
+    return mSlots.contains(sparse);
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline std::vector<typename ecs::shared_storage<dense_t, hash_t, equal_t>::sparse_type> const &ecs::shared_storage<dense_t, hash_t, equal_t>::sparse() const
+{
+    return mSlots.sparse();
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline bool ecs::shared_storage<dense_t, hash_t, equal_t>::empty() const
+{
+    return mSlots.empty();
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline std::size_t ecs::shared_storage<dense_t, hash_t, equal_t>::size() const
+{
+    return mSlots.size();
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::clear()
+{
+    ECS_PROFILE;
+    mValues.clear();
+    mReferences.clear();
+    mHashes.clear();
+    mInterned.clear();
+    mFreeSlots.clear();
+    mLookup.clear();
+    mSlots.clear();
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline std::size_t ecs::shared_storage<dense_t, hash_t, equal_t>::distinct() const
+{
+    return mValues.size() - mFreeSlots.size();
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline bool ecs::shared_storage<dense_t, hash_t, equal_t>::shared(sparse_type const &sparse) const
+{
+    ECS_ASSERT(contains(sparse), "Checking a non-existing element at a sparse index");
+    return mReferences[mSlots.get(sparse)] > 1;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+template <typename func_t>
+inline void ecs::shared_storage<dense_t, hash_t, equal_t>::each_value(func_t &&func) const
+{
+    ECS_PROFILE;
+    // bucket the owners by slot
+    std::vector<std::size_t> offsets(mValues.size() + 1, 0);
+    for(index_type slot : mSlots.dense())
+        ++offsets[slot + 1];
+    for(std::size_t i = 1; i < offsets.size(); ++i)
+        offsets[i] += offsets[i - 1];
+
+    std::vector<sparse_type> owners(mSlots.size());
+    std::vector<std::size_t> cursor(offsets.begin(), offsets.end() - 1);
+    for(auto [sparse, slot] : mSlots)
+        owners[cursor[slot]++] = sparse;
+
+    for(std::size_t slot = 0; slot < mValues.size(); ++slot)
+    {
+        if(mReferences[slot] != 0)
+            func(*mValues[slot], owners.data() + offsets[slot], owners.data() + offsets[slot + 1]);
+    }
+}
+
+template <typename dense_t>
+inline ecs::memory_stats ecs::hash_storage<dense_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    // a node holds the key-value pair, the next pointer and the cached hash
+    constexpr std::size_t nodeBytes = sizeof(std::pair<sparse_type const, index_type>) + sizeof(void *) + sizeof(std::size_t);
+    memory_stats stats;
+    stats.elements = mDense.size();
+    stats.denseBytes = mDense.capacity() * sizeof(dense_type);
+    stats.keyBytes = mDenseToSparse.capacity() * sizeof(sparse_type);
+    stats.sparseBytes = mIndex.bucket_count() * sizeof(void *) + mIndex.size() * nodeBytes;
+    stats.wastedBytes = 
+        (mDense.capacity() - mDense.size()) * sizeof(dense_type) + 
+        (mDenseToSparse.capacity() - mDenseToSparse.size()) * sizeof(sparse_type);
+    return stats;
+}
+template <typename dense_t>
+inline ecs::memory_stats ecs::stable_storage<dense_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    memory_stats stats = mIndex.memory_usage();
+    // the index stores slot numbers, the elements live in the slots
+    stats.keyBytes += stats.denseBytes;
+    stats.denseBytes = mSlots.size() * sizeof(std::optional<dense_type>);
+    stats.sparseBytes += mFreeSlots.capacity() * sizeof(index_type);
+    stats.wastedBytes += mFreeSlots.size() * sizeof(std::optional<dense_type>) + (mFreeSlots.capacity() - mFreeSlots.size()) * sizeof(index_type);
+    return stats;
+}
+template <typename dense_t>
+inline ecs::memory_stats ecs::boxed_storage<dense_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    memory_stats stats = mBoxes.memory_usage();
+    // the sparse set stores pointers, the elements are allocated separately
+    stats.keyBytes += stats.denseBytes;
+    stats.denseBytes = mBoxes.size() * sizeof(dense_type);
+    return stats;
+}
+template <typename dense_t>
+inline ecs::memory_stats ecs::singleton_storage<dense_t>::memory_usage() const
+{
+    memory_stats stats;
+    stats.elements = mOwner.size();
+    stats.denseBytes = sizeof(mValue);
+    stats.keyBytes = mOwner.capacity() * sizeof(sparse_type);
+    stats.wastedBytes = mValue.has_value() ? 0 : sizeof(mValue);
+    return stats;
+}
+template <typename dense_t, typename hash_t, typename equal_t>
+inline ecs::memory_stats ecs::shared_storage<dense_t, hash_t, equal_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    constexpr std::size_t nodeBytes = sizeof(std::pair<std::size_t const, index_type>) + sizeof(void *) + sizeof(std::size_t);
+    memory_stats stats = mSlots.memory_usage();
+    // the sparse set stores slot numbers, the distinct values are stored in the slots
+    stats.keyBytes += stats.denseBytes;
+    stats.denseBytes = mValues.capacity() * sizeof(std::optional<dense_type>);
+    stats.sparseBytes += 
+        mReferences.capacity() * sizeof(index_type) + 
+        mHashes.capacity() * sizeof(std::size_t) + 
+        mInterned.capacity() / 8 + 
+        mFreeSlots.capacity() * sizeof(index_type) + 
+        mLookup.bucket_count() * sizeof(void *) + mLookup.size() * nodeBytes;
+    stats.wastedBytes += (mValues.capacity() - distinct()) * sizeof(std::optional<dense_type>);
+    return stats;
+}
+
+template <typename dense_t>
+template <typename value_t>
+inline value_t &ecs::double_buffered<dense_t>::buffer<value_t>::get(sparse_type const &sparse) const
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Getting a non-existing element from a sparse index");
+    return mData[mIndex->getDenseIndex(sparse)];
+}
+template <typename dense_t>
+template <class... Args>
+inline void ecs::double_buffered<dense_t>::emplace(sparse_type const &sparse, Args &&...args)
+{
+    ECS_PROFILE;
+    mCurrent.emplace(sparse, std::forward<Args>(args)...);
+    mNext.push_back(mCurrent.get(sparse));
+}
+template <typename dense_t>
+inline void ecs::double_buffered<dense_t>::erase(sparse_type const &sparse)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse), "Removing a non-existing element from a sparse index");
+
+    // mirror the swap and pop of the sparse set
+    std::size_t const removed = mCurrent.getDenseIndex(sparse);
+    if(removed != mNext.size() - 1)
+        mNext[removed] = std::move(mNext.back());
+    mNext.pop_back();
+    mCurrent.erase(sparse);
+}
+template <typename dense_t>
+inline void ecs::double_buffered<dense_t>::copy(sparse_type const &sparse, double_buffered const &other, sparse_type const &from)
+{
+    ECS_PROFILE;
+    ECS_ASSERT(contains(sparse) && other.contains(from), "Copying a non-existing element of a sparse index");
+    mCurrent.get(sparse) = other.mCurrent.get(from);
+    mNext[mCurrent.getDenseIndex(sparse)] = other.mNext[other.mCurrent.getDenseIndex(from)];
+}
+template <typename dense_t>
+inline typename ecs::double_buffered<dense_t>::dense_type const &ecs::double_buffered<dense_t>::get(sparse_type const &sparse) const
+{
+    return mCurrent.get(sparse);
+}
+template <typename dense_t>
+inline typename ecs::double_buffered<dense_t>::dense_type &ecs::double_buffered<dense_t>::get(sparse_type const &sparse)
+{
+    return mCurrent.get(sparse);
+}
+template <typename dense_t>
+inline bool ecs::double_buffered<dense_t>::contains(sparse_type const &sparse) const
+{
+    return mCurrent.contains(sparse);
+}
+template <typename dense_t>
+inline std::vector<typename ecs::double_buffered<dense_t>::sparse_type> const &ecs::double_buffered<dense_t>::sparse() const
+{
+    return mCurrent.sparse();
+}
+template <typename dense_t>
+inline bool ecs::double_buffered<dense_t>::empty() const
+{
+    return mCurrent.empty();
+}
+template <typename dense_t>
+inline std::size_t ecs::double_buffered<dense_t>::size() const
+{
+    return mCurrent.size();
+}
+template <typename dense_t>
+inline void ecs::double_buffered<dense_t>::clear()
+{
+    ECS_PROFILE;
+    mCurrent.clear();
+    mNext.clear();
+}
+template <typename dense_t>
+inline ecs::memory_stats ecs::double_buffered<dense_t>::memory_usage() const
+{
+    ECS_PROFILE;
+    memory_stats stats = mCurrent.memory_usage();
+    stats.denseBytes += mNext.capacity() * sizeof(dense_type);
+    stats.wastedBytes += (mNext.capacity() - mNext.size()) * sizeof(dense_type);
+    return stats;
+}
+template <typename dense_t>
+inline typename ecs::double_buffered<dense_t>::template buffer<dense_t const> ecs::double_buffered<dense_t>::read() const
+{
+    return {mCurrent, mCurrent.denseData()};
+}
+template <typename dense_t>
+inline typename ecs::double_buffered<dense_t>::template buffer<dense_t> ecs::double_buffered<dense_t>::write()
+{
+    return {mCurrent, mNext.data()};
+}
+template <typename dense_t>
+inline void ecs::double_buffered<dense_t>::swap()
+{
+    mCurrent.exchangeDense(mNext);
+}
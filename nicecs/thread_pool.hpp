@@ -0,0 +1,166 @@
+/*
+      ___  ___ ___
+     / _ \/ __/ __|        Copyright (c) 2024 Nikita Martynau
+    |  __/ (__\__ \        https://opensource.org/license/mit
+     \___|\___|___/ v1.5.8 https://github.com/nikitawew/nicecs
+
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ecs
+{
+    /// @brief A fixed set of worker threads running batches of indexed tasks.
+    /// Any type with a parallel_for(count, func) member, that calls func(index) once for every index in [0, count) and returns when all calls are done, can be used instead (see basic_view::par_each).
+    /// The calling thread takes part in the work. Batches are run one at a time, parallel_for must not be called from a task.
+    class thread_pool
+    {
+    private:
+        /// @brief A parallel_for call. Lives on the stack of the caller.
+        struct Batch
+        {
+            std::function<void(std::size_t)> const *task;
+            std::size_t count;
+            std::atomic<std::size_t> next{0};
+            std::size_t finished = 0; // guarded by mMutex
+            std::size_t workers = 0;  // guarded by mMutex
+            std::exception_ptr exception;
+        };
+
+        std::vector<std::thread> mThreads;
+        std::mutex mBatchMutex; // one batch at a time
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        Batch *mBatch = nullptr;
+        std::size_t mGeneration = 0;
+        bool mStop = false;
+
+        void work();
+        void runTasks(Batch &batch);
+    public:
+        /// @param threads The number of worker threads, besides the calling thread.
+        explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() - 1 : 0);
+        ~thread_pool();
+        thread_pool(thread_pool const &) = delete;
+        thread_pool &operator=(thread_pool const &) = delete;
+
+        /// @brief Get the number of threads running the tasks, including the calling thread.
+        std::size_t size() const;
+
+        /// @brief Call func(index) for every index in [0, count), spread over the threads.
+        /// Blocks until all the calls return. The first exception thrown by a task is rethrown.
+        /// @param count The number of tasks.
+        /// @param func The task.
+        void parallel_for(std::size_t count, std::function<void(std::size_t)> const &func);
+    };
+} // namespace ecs
+
+/*! \cond Doxygen_Suppress */
+
+inline ecs::thread_pool::thread_pool(std::size_t threads)
+{
+    mThreads.reserve(threads);
+    for(std::size_t i = 0; i < threads; ++i)
+        mThreads.emplace_back([this]() { work(); });
+}
+inline ecs::thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for(auto &thread : mThreads)
+        thread.join();
+}
+inline std::size_t ecs::thread_pool::size() const
+{
+    return mThreads.size() + 1;
+}
+inline void ecs::thread_pool::runTasks(Batch &batch)
+{
+    std::size_t finished = 0;
+    std::exception_ptr exception;
+    for(std::size_t index = batch.next.fetch_add(1, std::memory_order_relaxed); index < batch.count; index = batch.next.fetch_add(1, std::memory_order_relaxed))
+    {
+        try
+        {
+            (*batch.task)(index);
+        }
+        catch(...)
+        {
+            if(!exception)
+                exception = std::current_exception();
+        }
+        ++finished;
+    }
+
+    std::lock_guard lock(mMutex);
+    batch.finished += finished;
+    if(exception && !batch.exception)
+        batch.exception = exception;
+    if(batch.finished == batch.count)
+        mDone.notify_all();
+}
+inline void ecs::thread_pool::work()
+{
+    std::size_t generation = 0;
+    while(true)
+    {
+        Batch *batch = nullptr;
+        {
+            std::unique_lock lock(mMutex);
+            mWake.wait(lock, [&]() { return mStop || (mBatch && mGeneration != generation); });
+            if(mStop)
+                return;
+            generation = mGeneration;
+            batch = mBatch;
+            ++batch->workers;
+        }
+        runTasks(*batch);
+        {
+            std::lock_guard lock(mMutex);
+            if(--batch->workers == 0)
+                mDone.notify_all();
+        }
+    }
+}
+inline void ecs::thread_pool::parallel_for(std::size_t count, std::function<void(std::size_t)> const &func)
+{
+    if(count == 0)
+        return;
+    std::lock_guard batchLock(mBatchMutex);
+    Batch batch;
+    batch.task = &func;
+    batch.count = count;
+    {
+        std::lock_guard lock(mMutex);
+        mBatch = &batch;
+        ++mGeneration;
+    }
+    mWake.notify_all();
+    runTasks(batch);
+
+    {
+        std::unique_lock lock(mMutex);
+        mDone.wait(lock, [&]() { return batch.finished == batch.count && batch.workers == 0; });
+        mBatch = nullptr;
+    }
+    if(batch.exception)
+        std::rethrow_exception(batch.exception);
+}
+
+/*! \endcond */
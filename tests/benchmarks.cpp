@@ -2,13 +2,20 @@
 #include "catch2/benchmark/catch_benchmark.hpp"
 #include "types.hpp"
 #include "nicecs/ecs.hpp"
+#include "nicecs/thread_pool.hpp"
+#include "nicecs/job_system.hpp"
+#include "nicecs/event_queue.hpp"
 
 #include <random>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <cstring>
 
 static constexpr std::size_t SIZE = 10'000;
+template<int N>
+struct Marker { int value; };
+
 static ecs::registry make_registry()
 {
     ecs::registry reg;
@@ -75,6 +82,156 @@ TEST_CASE("ecs::registry benchmarks", "[benchmark][ecs][ecs::registry]")
             auto v = registry.view<Position, Velocity>(ecs::exclude<Tag, Health>{});
             return v.size();
         };
+        BENCHMARK("count")
+        {
+            return registry.count<Position, Velocity>(ecs::exclude<Tag, Health>{});
+        };
+    }
+    {
+        auto const registry = make_registry();
+        BENCHMARK("view iteration")
+        {
+            ecs::entity sum = 0;
+            for(auto e : registry.view<Position, Velocity>(ecs::exclude<Tag, Health>{}))
+                sum += e;
+            return sum;
+        };
+    }
+    {
+        auto registry = make_registry();
+        BENCHMARK("view get")
+        {
+            for(auto e : registry.view<Position, Velocity>())
+                registry.get<Position>(e).x += registry.get<Velocity>(e).dx;
+            return registry.size();
+        };
+        BENCHMARK("view each")
+        {
+            registry.view<Position, Velocity>().each([](Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+            });
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        ecs::thread_pool pool;
+        BENCHMARK("view par_each")
+        {
+            registry.view<Position, Velocity>().par_each(pool, [](Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+            }, 256);
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        ecs::job_system jobs;
+        BENCHMARK("view par_each job_system")
+        {
+            registry.view<Position, Velocity>().par_each(jobs, [](Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+            }, 256);
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        registry.set_deterministic();
+        ecs::job_system jobs;
+        BENCHMARK("view par_each_commands deterministic")
+        {
+            registry.view<Position, Velocity>().par_each_commands(jobs, [](ecs::command_buffer &commands, ecs::entity e, Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+                if(e % 64 == 0)
+                    commands.create(Marker<5>{int(e)});
+            }, 256);
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        registry.arrange();
+        BENCHMARK("arranged view each")
+        {
+            registry.view<Position, Velocity>().each([](Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+            });
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        auto group = registry.group<Position, Velocity>();
+        BENCHMARK("group each")
+        {
+            group.each([](Position &position, Velocity const &velocity) {
+                position.x += velocity.dx;
+            });
+            return registry.size();
+        };
+    }
+    {
+        // one group for every combination of 8 components, the query matches 16 of them
+        ecs::registry registry;
+        for(unsigned mask = 0; mask < 256; ++mask)
+        {
+            for(int i = 0; i < 4; ++i)
+            {
+                auto e = registry.create<>();
+                if(mask & 1) registry.emplace<Position>(e);
+                if(mask & 2) registry.emplace<Velocity>(e);
+                if(mask & 4) registry.emplace<Tag>(e);
+                if(mask & 8) registry.emplace<Health>(e);
+                if(mask & 16) registry.emplace<Marker<0>>(e);
+                if(mask & 32) registry.emplace<Marker<1>>(e);
+                if(mask & 64) registry.emplace<Marker<2>>(e);
+                if(mask & 128) registry.emplace<Marker<3>>(e);
+            }
+        }
+        ecs::registry const &constRegistry = registry;
+        BENCHMARK("uncached view over many groups")
+        {
+            return constRegistry.view<Position, Velocity, Marker<0>>(ecs::exclude<Tag>{}).to_vector().size();
+        };
+        BENCHMARK("cached view over many groups")
+        {
+            return registry.view<Position, Velocity, Marker<0>>(ecs::exclude<Tag>{}).to_vector().size();
+        };
+
+        // a rare component, only its groups or its entities are walked
+        for(auto e : registry.view<Position>().to_vector())
+        {
+            if(e % 128 == 0)
+                registry.emplace<Marker<4>>(e);
+        }
+        BENCHMARK("rare component view over many groups")
+        {
+            return constRegistry.view<Position, Marker<4>>().to_vector().size();
+        };
+    }
+    {
+        // a few keys change every frame
+        auto registry = make_registry();
+        ecs::sorted_view<float, Position> sorted{[](Position const &position) { return position.x; }};
+        sorted.update(registry);
+        auto positions = registry.view<Position>().to_vector();
+        std::size_t frame = 0;
+        BENCHMARK("sorted view update")
+        {
+            registry.get<Position>(positions[frame++ % positions.size()]).x += 5;
+            sorted.update(registry);
+            return sorted.size();
+        };
+        BENCHMARK("sort view every frame")
+        {
+            registry.get<Position>(positions[frame++ % positions.size()]).x += 5;
+            auto entities = registry.view<Position>().to_vector();
+            std::sort(entities.begin(), entities.end(), [&](ecs::entity a, ecs::entity b) {
+                return registry.get<Position>(a).x < registry.get<Position>(b).x;
+            });
+            return entities.size();
+        };
     }
     {
         auto a = make_registry();
@@ -85,6 +242,34 @@ TEST_CASE("ecs::registry benchmarks", "[benchmark][ecs][ecs::registry]")
             return a.copy(e, b);
         };
     }
+    {
+        auto const source = make_registry();
+        ecs::registry target = source;
+        BENCHMARK("copy assignment")
+        {
+            target = source;
+            return target.size();
+        };
+    }
+    {
+        auto const source = make_registry();
+        ecs::snapshot<Position, Velocity> frame;
+        frame.extract(source);
+        BENCHMARK("snapshot extract")
+        {
+            frame.extract(source);
+            return frame.size();
+        };
+    }
+    {
+        auto const registry = make_registry();
+        ecs::registry_memory_stats stats;
+        BENCHMARK("memory usage")
+        {
+            registry.memory_usage(stats);
+            return stats.total();
+        };
+    }
     {
         ecs::registry registry;
         BENCHMARK("create and emplace")
@@ -94,6 +279,45 @@ TEST_CASE("ecs::registry benchmarks", "[benchmark][ecs][ecs::registry]")
             return e;
         };
     }
+    {
+        ecs::registry registry;
+        ecs::command_buffer commands{registry};
+        BENCHMARK("command buffer create and playback")
+        {
+            for(int i = 0; i < 100; ++i)
+                commands.create(Position{1.0f, 2.0f}, Velocity{});
+            commands.playback();
+            return registry.size();
+        };
+    }
+    {
+        ecs::registry registry;
+        ecs::staging_registry staging{registry};
+        BENCHMARK("staging registry create and commit")
+        {
+            for(int i = 0; i < 100; ++i)
+                staging.create(Position{1.0f, 2.0f}, Velocity{});
+            staging.commit();
+            return registry.size();
+        };
+    }
+    {
+        auto registry = make_registry();
+        auto &hits = ecs::events<Hit>(registry);
+        ecs::job_system jobs;
+        BENCHMARK("event queue push and drain")
+        {
+            registry.view<Health>().par_each(jobs, [&](ecs::entity e, Health const &) {
+                hits.push_to(registry, e, 1u, "benchmark");
+            }, 256);
+            unsigned sum = 0;
+            hits.drain(registry, [&](ecs::event_queue<Hit>::span span) {
+                for(Hit const &hit : span)
+                    sum += hit.damage;
+            });
+            return sum;
+        };
+    }
     {
         ecs::registry registry;
         BENCHMARK("create and destroy")
@@ -0,0 +1,180 @@
+#include "catch2/catch_test_macros.hpp"
+#include "types.hpp"
+#include "nicecs/ecs.hpp"
+#include "nicecs/event_queue.hpp"
+#include "nicecs/scheduler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Built with -fsanitize=thread, see CMakeLists.txt. A hidden write on a const path shows up as a data race.
+
+template<int N>
+struct Unused { int value; };
+
+static constexpr std::size_t READERS = 4;
+
+template<typename func_t>
+static std::vector<std::size_t> read_concurrently(func_t const &func)
+{
+    std::vector<std::size_t> results(READERS);
+    std::vector<std::thread> threads;
+    for(std::size_t i = 0; i < READERS; ++i)
+        threads.emplace_back([&, i]() { results[i] = func(); });
+    for(auto &thread : threads)
+        thread.join();
+    return results;
+}
+
+TEST_CASE("Concurrent const access", "[ecs][concurrency]")
+{
+    ecs::registry reg;
+    for(unsigned i = 0; i < 2000; ++i)
+    {
+        auto e = reg.create(Position{float(i), 0});
+        if(i % 2) reg.emplace<Velocity>(e, 1.0f, 0.0f);
+        if(i % 3) reg.emplace<Health>(e, i);
+        if(i % 5 == 0) reg.emplace<Tag>(e, "tag");
+    }
+    reg.destroy(7);
+    ecs::registry const &constReg = reg;
+
+    SECTION("valid, has and get")
+    {
+        auto results = read_concurrently([&]() {
+            std::size_t sum = 0;
+            for(ecs::entity e = 0; e < 2100; ++e)
+            {
+                if(!constReg.valid(e))
+                    continue;
+                // never used types get their ids here, from every thread at once
+                sum += constReg.has<Unused<0>>(e) + constReg.has<Unused<1>>(e);
+                if(constReg.has<Health>(e))
+                    sum += constReg.get<Health>(e).hp;
+                if(constReg.has<Velocity>(e))
+                    sum += static_cast<std::size_t>(constReg.get<Velocity>(e).dx);
+            }
+            return sum;
+        });
+        for(auto result : results)
+            REQUIRE(result == results.front());
+    }
+    SECTION("views")
+    {
+        ecs::query shared;
+        shared.all<Position>().none<Tag>();
+        auto results = read_concurrently([&]() {
+            std::size_t sum = constReg.count<Position, Velocity>() + constReg.any<Health>(ecs::exclude<Velocity>{});
+            for(auto e : constReg.view<Position>(ecs::exclude<Velocity>{}))
+                sum += e;
+            for(auto [e, position, health] : constReg.view<Position, Health>().each())
+                sum += static_cast<std::size_t>(position.x) + health.hp;
+            constReg.view<Velocity, Health>().each([&](Velocity const &velocity, Health const &) { sum += static_cast<std::size_t>(velocity.dx); });
+            // the id of a query is assigned on first use
+            sum += constReg.view(shared).size() + constReg.count(shared);
+            sum += constReg.view<Tag>().plan().pivotSize;
+            return sum;
+        });
+        for(auto result : results)
+            REQUIRE(result == results.front());
+    }
+    SECTION("cached views")
+    {
+        // the non-const overload caches the query, later const views only read the cache
+        reg.view<Position, Health>(ecs::exclude<Tag>{});
+        auto results = read_concurrently([&]() {
+            return constReg.view<Position, Health>(ecs::exclude<Tag>{}).to_vector().size();
+        });
+        for(auto result : results)
+            REQUIRE(result == reg.count<Position, Health>(ecs::exclude<Tag>{}));
+    }
+}
+
+TEST_CASE("Concurrent event pushes", "[ecs][concurrency]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> targets;
+    for(unsigned i = 0; i < 64; ++i)
+        targets.push_back(reg.create(Health{0}));
+    auto &hits = ecs::events<Hit>(reg);
+
+    for(int frame = 0; frame < 3; ++frame)
+    {
+        // every thread crosses many chunk boundaries, racing for the next chunk
+        read_concurrently([&]() {
+            for(unsigned i = 0; i < 5120; ++i)
+                hits.push_to(reg, targets[i % targets.size()], 1u, "hit");
+            return std::size_t{0};
+        });
+        std::size_t count = 0;
+        hits.drain(reg, [&](ecs::event_queue<Hit>::span span) {
+            for(std::size_t i = 0; i < span.size(); ++i)
+                reg.get<Health>(span.target(i)).hp += span[i].damage;
+            count += span.size();
+        });
+        REQUIRE(count == READERS * 5120);
+    }
+    for(auto e : targets)
+        REQUIRE(reg.get<Health>(e).hp == 3 * READERS * 5120 / targets.size());
+}
+
+TEST_CASE("Scheduled systems sharing a registry", "[ecs][concurrency]")
+{
+    ecs::registry reg;
+    for(unsigned i = 0; i < 2000; ++i)
+        reg.create(Position{float(i), 0}, Velocity{1, 0}, Health{0});
+
+    ecs::scheduler scheduler;
+    std::atomic<std::size_t> counted{0};
+    scheduler.add_each<Position, Velocity const>("movement", [](Position &position, Velocity const &velocity) { position.x += velocity.dx; });
+    scheduler.add_each<Health>("aging", [](Health &health) { ++health.hp; });
+    // builds a query the registry never saw while the other systems iterate
+    scheduler.add("queries", [&, frame = 0](ecs::registry &registry) mutable {
+        ecs::query terms;
+        terms.all<Velocity>();
+        if(++frame % 2 == 0)
+            terms.none<Unused<7>>();
+        counted += registry.view(terms).size();
+    }, ecs::reads<Velocity>{});
+
+    ecs::job_system jobs(3);
+    for(int frame = 0; frame < 4; ++frame)
+        scheduler.run(reg, jobs);
+    REQUIRE(counted == 4 * 2000);
+    reg.view<Health>().each([](Health const &health) { REQUIRE(health.hp == 4); });
+}
+
+TEST_CASE("Scheduled systems waiting for several others", "[ecs][concurrency]")
+{
+    // C waits for A and B, D waits for A and C: a job blocked waiting for B must not pick up D
+    ecs::registry reg;
+    ecs::scheduler scheduler;
+    std::vector<int> order;
+    std::atomic<int> slow{0};
+    scheduler.add("A", [&](ecs::registry &) { order.push_back(0); }, ecs::writes<Unused<1>>{});
+    scheduler.add("B", [&](ecs::registry &) { std::this_thread::sleep_for(std::chrono::microseconds(100)); ++slow; }, ecs::writes<Unused<2>>{});
+    scheduler.add("C", [&](ecs::registry &) { order.push_back(2); }, ecs::reads<Unused<1>, Unused<2>>{});
+    scheduler.add("D", [&](ecs::registry &) { order.push_back(3); }, ecs::writes<Unused<1>>{});
+
+    ecs::job_system jobs(3);
+    for(int frame = 0; frame < 500; ++frame)
+    {
+        order.clear();
+        scheduler.run(reg, jobs);
+        REQUIRE(order == std::vector<int>{0, 2, 3});
+    }
+    REQUIRE(slow == 500);
+
+    SECTION("throwing system")
+    {
+        scheduler.add("E", [calls = 0](ecs::registry &) mutable { if(calls++) throw std::runtime_error("E"); }, ecs::writes<Unused<3>>{});
+        scheduler.add("F", [&](ecs::registry &) { order.push_back(5); }, ecs::reads<Unused<3>>{});
+        scheduler.run(reg); // warm up the new systems
+        order.clear();
+        REQUIRE_THROWS_AS(scheduler.run(reg, jobs), std::runtime_error);
+        REQUIRE(order == std::vector<int>{0, 2, 3});
+    }
+}
@@ -2,12 +2,28 @@
 #include "types.hpp"
 #include "nicecs/ecs.hpp"
 #include "nicecs/ecs.hpp" // check if there are no odr issues
+#include "nicecs/thread_pool.hpp"
+#include "nicecs/job_system.hpp"
+#include "nicecs/scheduler.hpp"
+#include "nicecs/event_queue.hpp"
 
 #include <vector>
 #include <set>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
 
 /*! \cond Doxygen_Suppress */
 
+template<> struct ecs::storage_traits<Boss> { using storage_type = ecs::hash_storage<Boss>; };
+template<> struct ecs::storage_traits<Input> { using storage_type = ecs::singleton_storage<Input>; };
+template<> struct ecs::storage_traits<Terrain> { using storage_type = ecs::boxed_storage<Terrain>; };
+template<> struct ecs::storage_traits<Anchor> { using storage_type = ecs::stable_storage<Anchor>; };
+template<> struct ecs::storage_traits<Material> { using storage_type = ecs::shared_storage<Material>; };
+template<> struct ecs::storage_traits<Cell> { using storage_type = ecs::double_buffered<Cell>; };
+
 TEST_CASE("Sparse set tests", "[ecs][ecs::sparse_set]")
 {
     ecs::sparse_set<std::string> s;
@@ -161,6 +177,159 @@ TEST_CASE("emplacement of a aggregate type in the sparse set", "[ecs][ecs::spars
     REQUIRE(s.get(1) == Position{0.1f, 0.1f});
     REQUIRE(s.get(2) == Position{0.2f, 0.2f});
 }
+struct Relocatable {
+    std::unique_ptr<int> value;
+};
+template<> struct ecs::is_trivially_relocatable<Relocatable> : std::true_type {};
+
+TEST_CASE("sparse set relocation and copy", "[ecs][ecs::sparse_set]")
+{
+    ecs::sparse_set<Position> positions(10, 512);
+    for(std::size_t i = 0; i < 2000; i += 3)
+        positions.emplace(i, float(i), float(i));
+    positions.erase(300);
+
+    ecs::sparse_set<Position> copy;
+    copy.emplace(7, 1.0f, 1.0f);
+    copy = positions;
+    REQUIRE(copy.size() == positions.size());
+    REQUIRE_FALSE(copy.contains(7));
+    REQUIRE_FALSE(copy.contains(300));
+    REQUIRE(copy.get(1998) == Position{1998, 1998});
+    REQUIRE(copy.get(303) == Position{303, 303});
+
+    ecs::sparse_set<Relocatable> owners;
+    for(int i = 0; i < 10; ++i)
+        owners.emplace(i, std::make_unique<int>(i));
+    owners.erase(2);
+    owners.erase(0);
+    REQUIRE(owners.size() == 8);
+    for(auto [sparse, owner] : owners)
+        REQUIRE(*owner.value == int(sparse));
+
+    ecs::sparse_set<Relocatable> appended;
+    for(int i = 10; i < 1000; ++i)
+        appended.emplace(i, std::make_unique<int>(i));
+    owners.append(std::move(appended));
+    REQUIRE(appended.empty());
+    REQUIRE(owners.size() == 998);
+    REQUIRE(*owners.get(999).value == 999);
+    REQUIRE(*owners.get(5).value == 5);
+    for(auto [sparse, owner] : owners)
+        REQUIRE(*owner.value == int(sparse));
+}
+TEST_CASE("sparse set memory usage", "[ecs][ecs::sparse_set]")
+{
+    ecs::sparse_set<Position> positions(0, 256);
+    REQUIRE(positions.memory_usage().total() == 0);
+
+    positions.reserve(100);
+    positions.emplace(1000, 1.0f, 1.0f);
+    auto stats = positions.memory_usage();
+    REQUIRE(stats.elements == 1);
+    REQUIRE(stats.denseBytes == 100 * sizeof(Position));
+    REQUIRE(stats.keyBytes == 100 * sizeof(std::size_t));
+    REQUIRE(stats.sparsePages == 1);
+    REQUIRE(stats.sparseSlots == 256);
+    REQUIRE(stats.wastedBytes >= 99 * sizeof(Position) + 255 * sizeof(std::uint32_t));
+    REQUIRE(stats.total() > stats.wastedBytes);
+}
+TEST_CASE("Storage engines", "[ecs][ecs::storage_traits]")
+{
+    ecs::registry reg;
+
+    auto e0 = reg.create(Position{1, 1}, Boss{3});
+    auto e1 = reg.create(Position{2, 2}, Input{0.5f}, Terrain{{1, 2, 3}});
+    auto e2 = reg.create(Anchor{7});
+    auto e3 = reg.create(Position{3, 3}, Boss{5}, Anchor{8});
+
+    REQUIRE(reg.get<Boss>(e0).level == 3);
+    REQUIRE(reg.get<Boss>(e3).level == 5);
+    REQUIRE(reg.get<Input>(e1).axis == 0.5f);
+    REQUIRE(reg.get<Terrain>(e1).heights.size() == 3);
+    REQUIRE_THROWS_AS(reg.emplace<Input>(e0), EcsException);
+
+    Anchor *anchor = &reg.get<Anchor>(e2);
+    for(int i = 0; i < 1000; ++i)
+        reg.create(Anchor{i});
+    REQUIRE(anchor == &reg.get<Anchor>(e2));
+    REQUIRE(anchor->id == 7);
+
+    REQUIRE(reg.view<Position, Boss>().size() == 2);
+    REQUIRE(reg.view<Position>(ecs::exclude<Boss>{}).size() == 1);
+    REQUIRE(reg.view<Input>().size() == 1);
+
+    reg.remove<Boss>(e0);
+    REQUIRE_FALSE(reg.has<Boss>(e0));
+    REQUIRE(reg.get<Boss>(e3).level == 5);
+
+    ecs::registry copy = reg;
+    copy.get<Terrain>(e1).heights.push_back(4);
+    REQUIRE(reg.get<Terrain>(e1).heights.size() == 3);
+    REQUIRE(copy.get<Anchor>(e3).id == 8);
+
+    reg.destroy(e1);
+    REQUIRE(reg.getComponentManager().getComponentArray<Input>()->empty());
+    auto e4 = reg.create(Input{1.0f});
+    REQUIRE(reg.getComponentManager().getComponentArray<Input>()->value().axis == 1.0f);
+    REQUIRE(reg.get<Input>(e4).axis == 1.0f);
+}
+TEST_CASE("Shared components", "[ecs][ecs::shared_storage]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(unsigned i = 0; i < 99; ++i)
+        entities.push_back(reg.create(Material{{1, 1, 1, 1}, i % 3}));
+
+    auto &materials = reg.storage<Material>();
+    REQUIRE(materials.size() == 99);
+    REQUIRE(materials.distinct() == 3);
+    REQUIRE(materials.shared(entities[0]));
+    REQUIRE(&std::as_const(reg).get<Material>(entities[0]) == &std::as_const(reg).get<Material>(entities[3]));
+
+    // reads through a non-const registry keep the values shared
+    unsigned shaders = 0;
+    reg.view<Material>().each([&](Material const &material) { shaders += material.shader; });
+    for(auto [e, material] : reg.view<Material>().each())
+        shaders += material.shader;
+    shaders += reg.get<Material>(entities[1]).shader;
+    REQUIRE(shaders == 2 * 99 + 1);
+    REQUIRE(materials.distinct() == 3);
+
+    materials.write(entities[0]).shader = 42;
+    REQUIRE(materials.distinct() == 4);
+    REQUIRE_FALSE(materials.shared(entities[0]));
+    REQUIRE(std::as_const(reg).get<Material>(entities[3]).shader == 0);
+    REQUIRE(std::as_const(reg).get<Material>(entities[0]).shader == 42);
+    REQUIRE(materials.distinct() == 4);
+
+    materials.replace(entities[0], Material{{1, 1, 1, 1}, 1});
+    REQUIRE(materials.distinct() == 3);
+    REQUIRE(materials.shared(entities[0]));
+
+    std::size_t values = 0, owners = 0;
+    materials.each_value([&](Material const &, auto begin, auto end) {
+        ++values;
+        owners += end - begin;
+    });
+    REQUIRE(values == 3);
+    REQUIRE(owners == 99);
+
+    ecs::registry other;
+    auto copied = other.copy(entities[1], reg);
+    other.copy(entities[4], reg);
+    REQUIRE(other.storage<Material>().distinct() == 1);
+    REQUIRE(other.get<Material>(copied).shader == 1);
+
+    for(auto e : entities)
+        reg.destroy(e);
+    REQUIRE(materials.distinct() == 0);
+
+    // values are compared with operator==, not bytewise: -0.0 equals 0.0
+    reg.create(Material{{0.0f, 1, 1, 1}, 0});
+    reg.create(Material{{-0.0f, 1, 1, 1}, 0});
+    REQUIRE(materials.distinct() == 1);
+}
 TEST_CASE("Registry tests", "[ecs][ecs::registry]")
 {
     ecs::registry reg;
@@ -301,6 +470,100 @@ TEST_CASE("Registry tests", "[ecs][ecs::registry]")
 
         REQUIRE(reg.view<>().size() == reg.size());
         REQUIRE(reg.viewAny<>().size() == 0);
+        REQUIRE(reg.viewAny<>().empty());
+        REQUIRE_FALSE(reg.view<Velocity>().empty());
+
+        {
+            auto lazy = reg.view<Position>();
+            std::size_t visited = 0;
+            for(auto e : lazy)
+            {
+                REQUIRE(reg.has<Position>(e));
+                ++visited;
+            }
+            REQUIRE(visited == lazy.size());
+
+            auto snapshot = lazy.to_vector();
+            REQUIRE(snapshot.size() == 3);
+            for(auto e : snapshot)
+                reg.destroy(e);
+            REQUIRE(lazy.empty());
+            REQUIRE(reg.view<Velocity>().size() == 1);
+        }
+    }
+
+    SECTION("count and any")
+    {
+        reg.create(Position{}, Velocity{});
+        reg.create(Position{}, Health{});
+        auto e2 = reg.create(Position{}, Velocity{}, Tag{});
+
+        ecs::registry const &constReg = reg;
+        REQUIRE(constReg.count<Position>() == 3);
+        REQUIRE(constReg.count<Position>(ecs::exclude<Tag>{}) == 2);
+        REQUIRE(constReg.count<>() == reg.size());
+        REQUIRE(constReg.any<Velocity, Tag>());
+        REQUIRE_FALSE(constReg.any<Health, Tag>());
+        REQUIRE(constReg.count(ecs::query{}.any<Health, Tag>()) == 2);
+        REQUIRE(constReg.any(ecs::query{}.all<Position>().none<Velocity>()));
+
+        // the cached groups are used after a view, emptied groups count as zero
+        REQUIRE(reg.view<Position, Velocity>().size() == 2);
+        reg.destroy(e2);
+        REQUIRE(constReg.count<Position, Velocity>() == 1);
+        REQUIRE(constReg.count<Position, Velocity>() == reg.view<Position, Velocity>().size());
+        REQUIRE_FALSE(constReg.any<Tag>());
+    }
+
+    SECTION("cached queries")
+    {
+        auto e0 = reg.create(Position{}, Velocity{});
+        auto const &entityManager = reg.getEntityManager();
+
+        auto view = reg.view<Position>(ecs::exclude<Health>{});
+        auto id = ecs::impl::EntityManager::getQueryID<ecs::impl::type_list<std::false_type, ecs::impl::type_list<Position>, ecs::impl::type_list<Health>>>();
+        auto const *query = entityManager.findQuery(id);
+        REQUIRE(query != nullptr);
+        auto cached = query->groups.size();
+        REQUIRE(std::find(query->groups.begin(), query->groups.end(), entityManager.getGroupIndex(e0)) != query->groups.end());
+
+        // groups created after the query are added to the cache
+        auto e1 = reg.create(Position{}, Tag{});
+        auto e2 = reg.create(Position{}, Health{});
+        query = entityManager.findQuery(id);
+        REQUIRE(query->groups.size() == cached + 1);
+        REQUIRE(view.size() == 2);
+        REQUIRE(std::find(view.begin(), view.end(), e2) == view.end());
+
+        // emptied groups stay cached, but are skipped
+        reg.destroy(e0);
+        REQUIRE(query->groups.size() == cached + 1);
+        REQUIRE(view.to_vector() == std::vector<ecs::entity>{e1});
+
+        // the const view uses the cache of the non-const one and agrees with an uncached query
+        ecs::registry const &constReg = reg;
+        REQUIRE(constReg.view<Position>(ecs::exclude<Health>{}).to_vector() == std::vector<ecs::entity>{e1});
+        REQUIRE(constReg.view<Tag, Position>().to_vector() == std::vector<ecs::entity>{e1});
+
+        // caches are copied with the registry
+        ecs::registry copy = reg;
+        REQUIRE(copy.getEntityManager().findQuery(id) != nullptr);
+        REQUIRE(copy.view<Position>(ecs::exclude<Health>{}).to_vector() == std::vector<ecs::entity>{e1});
+
+        // pruning drops the emptied groups from the caches
+        auto const groups = entityManager.getGroups().size();
+        reg.prune_groups();
+        REQUIRE(entityManager.getGroups().size() < groups);
+        for(auto const &group : entityManager.getGroups())
+            REQUIRE_FALSE(group.empty());
+        REQUIRE(query->groups == std::vector<ecs::impl::group_index>{entityManager.getGroupIndex(e1)});
+        REQUIRE(reg.view<Position>(ecs::exclude<Health>{}).to_vector() == std::vector<ecs::entity>{e1});
+        REQUIRE(entityManager.getSignature(e2) == ecs::signature{}.set(ecs::impl::ComponentManager::getComponentID<Position>()).set(ecs::impl::ComponentManager::getComponentID<Health>()));
+        REQUIRE(reg.get<Health>(e2).hp == 0);
+        reg.destroy(e1);
+        auto const e3 = reg.create(Position{}, Velocity{});
+        REQUIRE(reg.view<Position>(ecs::exclude<Health>{}).to_vector() == std::vector<ecs::entity>{e3});
+        REQUIRE(constReg.count(ecs::query{}.all<Position>()) == 2);
     }
 
     SECTION("copy")
@@ -386,6 +649,39 @@ TEST_CASE("Registry tests", "[ecs][ecs::registry]")
 
         REQUIRE(reg.get<Health>(e1).hp != 7);
     }
+    SECTION("memory usage")
+    {
+        for(int i = 0; i < 100; ++i)
+            reg.create(Position{}, Velocity{});
+        reg.create(Tag{"tag"});
+
+        ecs::registry_memory_stats stats;
+        reg.memory_usage(stats);
+        // groups are kept after they are emptied
+        REQUIRE(std::count_if(stats.groups.begin(), stats.groups.end(), [](auto const &g) { return g.second.elements != 0; }) == 2);
+        REQUIRE(stats.entities.elements == 101);
+        auto position = std::find_if(stats.components.begin(), stats.components.end(), [](auto const &c) { 
+            return c.first == ecs::impl::ComponentManager::getComponentID<Position>(); 
+        });
+        REQUIRE(position != stats.components.end());
+        REQUIRE(position->second.elements == 100);
+        REQUIRE(position->second.denseBytes >= 100 * sizeof(Position));
+        REQUIRE(stats.total() >= position->second.total() + stats.entities.total());
+    }
+    SECTION("registry copy assignment")
+    {
+        auto e0 = reg.create(Position{1, 1}, Health{10});
+        ecs::registry target;
+        target.create(Tag{"overwritten"}, Velocity{});
+        target = reg;
+        REQUIRE(target.size() == 1);
+        REQUIRE(target.get<Health>(e0).hp == 10);
+        REQUIRE(target.view<Tag>().empty());
+
+        reg.get<Health>(e0).hp = 20;
+        target = reg;
+        REQUIRE(target.get<Health>(e0).hp == 20);
+    }
     SECTION("registry entity copy semantics")
     {
         ecs::registry reg;
@@ -432,6 +728,1186 @@ TEST_CASE("Registry tests", "[ecs][ecs::registry]")
     }
 }
 
+TEST_CASE("Registry context", "[ecs][ecs::registry]")
+{
+    ecs::registry reg;
+    REQUIRE_FALSE(reg.ctx().contains<Input>());
+    REQUIRE(reg.ctx().find<Input>() == nullptr);
+    REQUIRE_THROWS_AS(reg.ctx().get<Input>(), EcsException);
+
+    reg.ctx().emplace<Input>(0.25f);
+    reg.ctx().emplace<Tag>("world");
+    REQUIRE(reg.ctx().get<Input>().axis == 0.25f);
+    REQUIRE(reg.ctx().find<Tag>()->s == "world");
+    REQUIRE(reg.view<>().size() == 0);
+
+    reg.ctx().emplace<Input>(1.0f);
+    REQUIRE(reg.ctx().size() == 2);
+    REQUIRE(reg.ctx().get<Input>().axis == 1.0f);
+
+    ecs::registry copy = reg;
+    copy.ctx().get<Tag>().s = "copy";
+    REQUIRE(reg.ctx().get<Tag>().s == "world");
+    REQUIRE(copy.ctx().get<Input>().axis == 1.0f);
+
+    ecs::registry const &constReg = reg;
+    REQUIRE(constReg.ctx().get<Input>().axis == 1.0f);
+
+    reg.ctx().erase<Input>();
+    REQUIRE_FALSE(reg.ctx().contains<Input>());
+    REQUIRE(reg.ctx().contains<Tag>());
+}
+
+TEST_CASE("Runtime queries", "[ecs][ecs::query]")
+{
+    ecs::registry reg;
+    auto e0 = reg.create(Position{}, Velocity{});
+    auto e1 = reg.create(Position{}, Health{});
+    auto e2 = reg.create(Position{}, Velocity{}, Tag{});
+    auto e3 = reg.create(Velocity{});
+
+    auto sorted = [](std::vector<ecs::entity> entities) { std::sort(entities.begin(), entities.end()); return entities; };
+
+    // all and any combined, with none, built from component ids
+    ecs::query q;
+    q.all(ecs::impl::ComponentManager::getComponentID<Position>())
+        .any(ecs::impl::ComponentManager::getComponentID<Velocity>())
+        .any(ecs::impl::ComponentManager::getComponentID<Health>())
+        .none(ecs::impl::ComponentManager::getComponentID<Tag>());
+    REQUIRE(sorted(reg.view(q).to_vector()) == std::vector<ecs::entity>{e0, e1});
+
+    // optional terms do not affect matching
+    q.optional<Tag>();
+    REQUIRE(q.optional_mask().test(ecs::impl::ComponentManager::getComponentID<Tag>()));
+    REQUIRE(sorted(reg.view(q).to_vector()) == std::vector<ecs::entity>{e0, e1});
+
+    // the query is reused across frames, new groups are picked up by the cache
+    auto id = q.id();
+    REQUIRE(reg.getEntityManager().findQuery(id) != nullptr);
+    auto e4 = reg.create(Position{}, Health{}, Anchor{});
+    REQUIRE(q.id() == id);
+    REQUIRE(sorted(reg.view(q).to_vector()) == std::vector<ecs::entity>{e0, e1, e4});
+
+    // changing the terms gives a new id, the const view agrees with the cached one
+    q.none<Health>();
+    REQUIRE(q.id() != id);
+    ecs::registry const &constReg = reg;
+    REQUIRE(constReg.view(q).to_vector() == std::vector<ecs::entity>{e0});
+    REQUIRE(reg.view(q).to_vector() == std::vector<ecs::entity>{e0});
+
+    REQUIRE(reg.view(ecs::query{}).size() == reg.size());
+    REQUIRE(reg.view(ecs::query{}.any<>()).empty());
+    REQUIRE(sorted(reg.view(ecs::query{}.any<Velocity, Health>().none<Position>()).to_vector()) == std::vector<ecs::entity>{e3});
+    REQUIRE(reg.view(ecs::query{}.all<Tag>()).to_vector() == std::vector<ecs::entity>{e2});
+
+    // queries built every frame share the cache of their terms, the registry does not grow
+    REQUIRE(ecs::query{}.all<Position>().any<Health, Velocity>().none<Health, Tag>().id() == q.id());
+    auto frame = [&]() { return reg.view(ecs::query{}.all<Position>().any<Velocity, Health>().optional<Tag>()).size(); };
+    REQUIRE(frame() == 4);
+    auto before = reg.memory_usage().total();
+    for(int i = 0; i < 1000; ++i)
+        frame();
+    REQUIRE(reg.memory_usage().total() == before);
+}
+
+TEST_CASE("View planning", "[ecs][ecs::view_plan]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> bosses;
+    for(int i = 0; i < 200; ++i)
+    {
+        auto e = reg.create(Position{float(i), 0});
+        if(i % 2) reg.emplace<Velocity>(e);
+        if(i % 3) reg.emplace<Health>(e);
+        if(i % 5) reg.emplace<Tag>(e);
+        if(i % 40 == 0)
+        {
+            reg.emplace<Boss>(e, 1u);
+            bosses.push_back(e);
+        }
+    }
+    // move a boss through every combination of the other components, leaving empty groups behind
+    auto boss = bosses.front();
+    for(unsigned mask = 0; mask < 8; ++mask)
+    {
+        if(reg.has<Velocity>(boss) != bool(mask & 1)) { if(mask & 1) reg.emplace<Velocity>(boss); else reg.remove<Velocity>(boss); }
+        if(reg.has<Health>(boss) != bool(mask & 2)) { if(mask & 2) reg.emplace<Health>(boss); else reg.remove<Health>(boss); }
+        if(reg.has<Tag>(boss) != bool(mask & 4)) { if(mask & 4) reg.emplace<Tag>(boss); else reg.remove<Tag>(boss); }
+    }
+    auto sorted = [](std::vector<ecs::entity> entities) { std::sort(entities.begin(), entities.end()); return entities; };
+    ecs::registry const &constReg = reg;
+
+    // few bosses, more groups with a boss: walk the bosses
+    auto rare = constReg.view<Position, Boss>();
+    auto plan = rare.plan();
+    REQUIRE(plan.kind == ecs::view_plan::strategy::pivot);
+    REQUIRE_FALSE(plan.cached);
+    REQUIRE(plan.pivot == ecs::impl::ComponentManager::getComponentID<Boss>());
+    REQUIRE(plan.pivotSize == bosses.size());
+    REQUIRE(plan.cost == bosses.size());
+    REQUIRE(rare.size() == bosses.size());
+    REQUIRE(sorted(rare.to_vector()) == bosses);
+    REQUIRE(sorted({rare.begin(), rare.end()}) == bosses);
+    std::size_t visited = 0;
+    rare.each([&](ecs::entity e, Position const &position, Boss const &) { REQUIRE(&position == &reg.get<Position>(e)); ++visited; });
+    REQUIRE(visited == bosses.size());
+
+    // the pivot tests every term of the query
+    auto filtered = constReg.view<Boss>(ecs::exclude<Velocity>{});
+    REQUIRE(filtered.plan().kind == ecs::view_plan::strategy::pivot);
+    for(auto e : filtered)
+        REQUIRE_FALSE(reg.has<Velocity>(e));
+    // a pivot iterator hands out copies of the entity it holds
+    auto it = filtered.begin();
+    ecs::entity const first = *it++;
+    REQUIRE(first != *it);
+    REQUIRE(first == *filtered.begin());
+    REQUIRE(*it.operator->() == *it);
+
+    // common components: scan the groups containing the rarest of them
+    auto common = constReg.view<Position, Velocity>();
+    REQUIRE(common.plan().kind == ecs::view_plan::strategy::group_scan);
+    REQUIRE(common.plan().groups == reg.getEntityManager().getComponentGroups(ecs::impl::ComponentManager::getComponentID<Velocity>()).size());
+    REQUIRE(common.plan().groups < reg.getEntityManager().getGroups().size());
+    REQUIRE(common.size() == reg.count<Velocity>());
+
+    // the cached query walks only the matching groups
+    auto cached = reg.view<Position, Velocity>(ecs::exclude<Boss>{});
+    REQUIRE(cached.plan().cached);
+    REQUIRE(cached.plan().kind == ecs::view_plan::strategy::group_scan);
+    REQUIRE(cached.size() == constReg.view<Position, Velocity>(ecs::exclude<Boss>{}).size());
+
+    // no all terms, nothing to pivot on
+    REQUIRE(constReg.viewAny<Boss>().plan().kind == ecs::view_plan::strategy::group_scan);
+}
+
+TEST_CASE("Sorted views", "[ecs][ecs::sorted_view]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(int i = 0; i < 100; ++i)
+        entities.push_back(reg.create(Position{float((i * 37) % 100), 0}));
+    reg.create(Velocity{});
+
+    ecs::sorted_view<float, Position> byX{[](Position const &position) { return position.x; }};
+    auto isSorted = [&]() {
+        return std::is_sorted(byX.begin(), byX.end(), [&](ecs::entity a, ecs::entity b) {
+            auto const &pa = reg.get<Position>(a);
+            auto const &pb = reg.get<Position>(b);
+            return pa.x < pb.x || (pa.x == pb.x && a < b);
+        });
+    };
+
+    REQUIRE(byX.empty());
+    byX.update(reg);
+    REQUIRE(byX.size() == 100);
+    REQUIRE(isSorted());
+
+    // changed keys, removed, destroyed and new entities
+    reg.get<Position>(entities[10]).x = -1;
+    reg.get<Position>(entities[20]).x = 1000;
+    reg.remove<Position>(entities[30]);
+    reg.destroy(entities[40]);
+    auto added = reg.create(Position{50.5f, 0});
+    reg.create(Position{50.5f, 0});
+    byX.update(reg);
+    REQUIRE(byX.size() == 100);
+    REQUIRE(isSorted());
+    REQUIRE(byX.entities().front() == entities[10]);
+    REQUIRE(byX.entities().back() == entities[20]);
+    REQUIRE(std::find(byX.begin(), byX.end(), entities[30]) == byX.end());
+    REQUIRE(std::find(byX.begin(), byX.end(), added) != byX.end());
+
+    // a reversed order falls back to a full sort
+    for(auto e : reg.view<Position>())
+        reg.get<Position>(e).x = -reg.get<Position>(e).x;
+    byX.update(reg);
+    REQUIRE(isSorted());
+
+    // the entity removed earlier comes back
+    reg.emplace<Position>(entities[30], 3.0f, 0.0f);
+    byX.update(reg);
+    REQUIRE(byX.size() == 101);
+    REQUIRE(isSorted());
+}
+
+TEST_CASE("Arranged component arrays", "[ecs][ecs::registry]")
+{
+    ecs::registry reg;
+    for(int i = 0; i < 50; ++i)
+    {
+        auto e = reg.create(Position{float(i), 0});
+        if(i % 2) reg.emplace<Velocity>(e, 1.0f, 0.0f);
+        if(i % 3) reg.emplace<Health>(e, unsigned(i));
+    }
+    ecs::signature included;
+    included.set(ecs::impl::ComponentManager::getComponentID<Position>());
+    included.set(ecs::impl::ComponentManager::getComponentID<Velocity>());
+    REQUIRE_FALSE(reg.arranged(included));
+
+    reg.arrange();
+    REQUIRE(reg.arranged(included));
+
+    // every group is a contiguous run in each array
+    auto const &positions = reg.storage<Position>();
+    for(auto const &group : reg.getEntityManager().getGroups())
+    {
+        if(group.empty() || !reg.has<Position>(group.front()))
+            continue;
+        auto first = positions.getDenseIndex(group.front());
+        for(std::size_t i = 0; i < group.size(); ++i)
+            REQUIRE(positions.sparse()[first + i] == group[i]);
+    }
+
+    std::size_t visited = 0;
+    reg.view<Position, Velocity>().each([&](ecs::entity e, Position &position, Velocity &velocity) {
+        REQUIRE(&position == &reg.get<Position>(e));
+        REQUIRE(&velocity == &reg.get<Velocity>(e));
+        ++visited;
+    });
+    REQUIRE(visited == 25);
+
+    // entities without the components leave the arrangement as is
+    auto lone = reg.create(Health{7});
+    reg.emplace<Tag>(lone);
+    reg.destroy(lone);
+    REQUIRE(reg.arranged(included));
+    REQUIRE_FALSE(reg.arranged(ecs::signature{}.set(ecs::impl::ComponentManager::getComponentID<Health>())));
+
+    // structural changes of entities having them end it, each falls back to lookups
+    reg.create(Position{}, Velocity{});
+    REQUIRE_FALSE(reg.arranged(included));
+    visited = 0;
+    reg.view<Position, Velocity>().each([&](ecs::entity e, Position &position, Velocity &) { REQUIRE(&position == &reg.get<Position>(e)); ++visited; });
+    REQUIRE(visited == 26);
+
+    // pruning an emptied group keeps the reordered arrays unarranged
+    {
+        ecs::registry pruned;
+        for(int i = 0; i < 40; ++i)
+        {
+            if(i % 2)
+                pruned.create(Position{float(i), 0}, Velocity{});
+            else
+                pruned.create(Position{float(i), 0});
+        }
+        pruned.arrange();
+        for(ecs::entity e : pruned.view<Position, Velocity>().to_vector())
+            pruned.destroy(e);
+        pruned.prune_groups();
+        ecs::signature positions;
+        positions.set(ecs::impl::ComponentManager::getComponentID<Position>());
+        REQUIRE_FALSE(pruned.arranged(positions));
+        std::size_t matched = 0;
+        pruned.view<Position>().each([&](ecs::entity e, Position &position) { REQUIRE(&position == &pruned.get<Position>(e)); ++matched; });
+        REQUIRE(matched == 20);
+    }
+
+    // owned arrays are not arranged
+    reg.group<Position, Velocity>();
+    reg.arrange();
+    REQUIRE_FALSE(reg.arranged(included));
+    included.reset();
+    included.set(ecs::impl::ComponentManager::getComponentID<Health>());
+    REQUIRE(reg.arranged(included));
+}
+
+TEST_CASE("Parallel each", "[ecs][ecs::thread_pool]")
+{
+    ecs::thread_pool pool(3);
+    REQUIRE(pool.size() == 4);
+
+    std::vector<std::atomic<int>> calls(1000);
+    pool.parallel_for(calls.size(), [&](std::size_t index) { ++calls[index]; });
+    REQUIRE(std::all_of(calls.begin(), calls.end(), [](auto const &c) { return c == 1; }));
+    REQUIRE_THROWS_AS(pool.parallel_for(10, [](std::size_t index) { if(index == 5) throw std::runtime_error("task"); }), std::runtime_error);
+    pool.parallel_for(0, [](std::size_t) { FAIL(); });
+
+    ecs::registry reg;
+    for(int i = 0; i < 5000; ++i)
+    {
+        auto e = reg.create(Position{float(i), 0}, Velocity{1, 0});
+        if(i % 3 == 0) reg.emplace<Health>(e, 0u);
+    }
+    reg.create(Position{-1, 0});
+
+    reg.view<Position, Velocity>().par_each(pool, [](Position &position, Velocity const &velocity) { position.x += velocity.dx; }, 64);
+    reg.view<Health>().par_each(pool, [](ecs::entity e, Health &health) { health.hp = e; }, 100);
+
+    std::size_t moved = 0;
+    reg.view<Position, Velocity>().each([&](ecs::entity e, Position const &position, Velocity const &) {
+        moved += position.x == float(e);
+    });
+    REQUIRE(moved == 5000);
+    for(auto [e, health] : reg.view<Health>().each())
+        REQUIRE(health.hp == e);
+
+    std::atomic<std::size_t> visited = 0;
+    ecs::registry const &constReg = reg;
+    constReg.view<Position>().par_each(pool, [&](Position const &) { ++visited; }, 7);
+    REQUIRE(visited == reg.count<Position>());
+}
+
+TEST_CASE("Job system", "[ecs][ecs::job_system]")
+{
+    ecs::job_system jobs(3);
+    REQUIRE(jobs.size() == 4);
+
+    SECTION("parallel for")
+    {
+        std::vector<std::atomic<int>> calls(10000);
+        jobs.parallel_for(calls.size(), [&](std::size_t index) { ++calls[index]; });
+        REQUIRE(std::all_of(calls.begin(), calls.end(), [](auto const &c) { return c == 1; }));
+        jobs.parallel_for(3, [&](std::size_t index) { ++calls[index]; });
+        REQUIRE(calls[2] == 2);
+        REQUIRE(calls[3] == 1);
+        REQUIRE_THROWS_AS(jobs.parallel_for(100, [](std::size_t index) { if(index == 50) throw std::runtime_error("task"); }), std::runtime_error);
+        jobs.parallel_for(0, [](std::size_t) { FAIL(); });
+
+        // nested
+        std::atomic<std::size_t> sum = 0;
+        jobs.parallel_for(16, [&](std::size_t) {
+            jobs.parallel_for(100, [&](std::size_t index) { sum += index; });
+        });
+        REQUIRE(sum == 16 * 4950);
+    }
+    SECTION("continuations")
+    {
+        std::vector<int> order;
+        std::mutex mutex;
+        auto record = [&](int step) {
+            std::lock_guard lock(mutex);
+            order.push_back(step);
+        };
+        auto first = jobs.run([&]() { record(0); });
+        auto second = jobs.then(first, [&]() { record(1); });
+        auto third = jobs.then(second, [&]() { record(2); });
+        jobs.wait(third);
+        REQUIRE(first.done());
+        REQUIRE(order == std::vector<int>{0, 1, 2});
+
+        // continuing a finished job schedules right away
+        jobs.wait(jobs.then(first, [&]() { record(3); }));
+        REQUIRE(order.back() == 3);
+        REQUIRE(ecs::job_system::handle{}.done());
+
+        auto failing = jobs.run([]() { throw std::runtime_error("job"); });
+        auto after = jobs.then(failing, [&]() { record(4); });
+        REQUIRE_THROWS_AS(jobs.wait(failing), std::runtime_error);
+        jobs.wait(after);
+        REQUIRE(order.back() == 4);
+
+        // jobs waiting for jobs
+        std::atomic<int> leaves = 0;
+        auto root = jobs.run([&]() {
+            std::vector<ecs::job_system::handle> children;
+            for(int i = 0; i < 50; ++i)
+                children.push_back(jobs.run([&]() { ++leaves; }));
+            for(auto const &child : children)
+                jobs.wait(child);
+        });
+        jobs.wait(root);
+        REQUIRE(leaves == 50);
+    }
+    SECTION("par_each")
+    {
+        ecs::registry reg;
+        for(int i = 0; i < 5000; ++i)
+            reg.create(Position{float(i), 0}, Velocity{1, 0});
+        reg.view<Position, Velocity>().par_each(jobs, [](Position &position, Velocity const &velocity) { position.x += velocity.dx; }, 64);
+        std::size_t moved = 0;
+        reg.view<Position, Velocity>().each([&](ecs::entity e, Position const &position, Velocity const &) {
+            moved += position.x == float(e);
+        });
+        REQUIRE(moved == 5000);
+    }
+}
+
+TEST_CASE("Scheduler", "[ecs][ecs::scheduler]")
+{
+    ecs::registry reg;
+    for(int i = 0; i < 1000; ++i)
+        reg.create(Position{0, 0}, Velocity{1, 2}, Health{0});
+
+    ecs::scheduler scheduler;
+    std::atomic<int> spawned = 0;
+    auto const movement = scheduler.add_each<Position, Velocity const>("movement", [](Position &position, Velocity const &velocity) {
+        position.x += velocity.dx;
+    });
+    auto const aging = scheduler.add_each<Health>("aging", [](Health &health) { ++health.hp; });
+    std::atomic<int> unmoved = 0;
+    auto const render = scheduler.add("render", [&](ecs::registry &registry) {
+        for(auto [e, position] : registry.view<Position>().each())
+            unmoved += position.x == 0;
+    }, ecs::reads<Position>{});
+    auto const spawn = scheduler.add_exclusive("spawn", [&](ecs::registry &registry) {
+        registry.create(Position{1, 1});
+        ++spawned;
+    });
+    auto const steering = scheduler.add("steering", [](ecs::registry &registry) {
+        registry.view<Velocity>().each([](Velocity &velocity) { velocity.dy = 0; });
+    }, ecs::reads<Position>{}, ecs::writes<Velocity>{});
+    std::atomic<int> unaged = 0;
+    auto const stats = scheduler.add_each<Health const>("stats", [&](Health const &health) { unaged += health.hp == 0; });
+    REQUIRE(scheduler.size() == 6);
+
+    // movement and aging don't conflict, render waits for movement, spawn for everything, steering and stats run after spawn
+    using waves = std::vector<std::vector<std::size_t>>;
+    REQUIRE(scheduler.waves() == waves{{movement, aging}, {render}, {spawn}, {steering, stats}});
+
+    ecs::thread_pool pool(3);
+    for(int frame = 1; frame <= 3; ++frame)
+    {
+        scheduler.run(reg, pool);
+        REQUIRE(spawned == frame);
+        REQUIRE(reg.get<Health>(1).hp == unsigned(frame));
+        REQUIRE(reg.get<Position>(1).x == float(frame));
+        REQUIRE(reg.get<Velocity>(1).dy == 0);
+    }
+    scheduler.run(reg);
+    REQUIRE(spawned == 4);
+
+    // with a job system, a system starts once the systems it conflicts with are done
+    ecs::job_system jobs(3);
+    for(int frame = 5; frame <= 7; ++frame)
+    {
+        scheduler.run(reg, jobs);
+        REQUIRE(spawned == frame);
+        REQUIRE(reg.get<Health>(1).hp == unsigned(frame));
+        REQUIRE(reg.get<Position>(1).x == float(frame));
+    }
+    REQUIRE(unmoved == 0);
+    REQUIRE(unaged == 0);
+
+    // systems sharing the registry do not register the queries they see for the first time
+    ecs::scheduler late;
+    int runs = 0;
+    std::size_t counted = 0;
+    late.add_each<Health const>("reader", [](Health const &) {});
+    late.add("late query", [&](ecs::registry &registry) {
+        auto terms = ecs::query{}.all<Position>().none<Velocity>();
+        if(runs++ == 1)
+            terms.none<Health>();
+        counted = registry.view(terms).size();
+    }, ecs::reads<Position, Velocity, Health>{});
+    REQUIRE(late.waves().size() == 1);
+    late.run(reg, jobs);
+    late.run(reg, jobs);
+    REQUIRE(counted == 7);
+    REQUIRE(reg.getEntityManager().findQuery(ecs::query{}.all<Position>().none<Velocity, Health>().id()) == nullptr);
+
+    auto const &timings = scheduler.timings();
+    REQUIRE(timings.size() == 6);
+    REQUIRE(timings[movement].name == "movement");
+    REQUIRE(timings[stats].runs == 7);
+    REQUIRE(timings[aging].total >= timings[aging].last);
+    scheduler.reset_timings();
+    REQUIRE(timings[movement].runs == 0);
+    REQUIRE(timings[movement].total.count() == 0);
+}
+
+TEST_CASE("Command buffers", "[ecs][ecs::command_buffer]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(int i = 0; i < 100; ++i)
+        entities.push_back(reg.create(Position{float(i), 0}, Health{unsigned(i)}));
+
+    SECTION("playback")
+    {
+        ecs::command_buffer commands{reg};
+        REQUIRE(commands.empty());
+        auto const spawned = commands.create(Position{1, 2}, Tag{"spawned"});
+        auto const empty = commands.create();
+        REQUIRE_FALSE(reg.valid(spawned));
+        REQUIRE(spawned != empty);
+        commands.emplace<Velocity>(spawned, 3.0f, 4.0f);
+        commands.emplace<Velocity>(entities[0], 1.0f, 1.0f);
+        commands.emplace<Tag>(entities[0], "first");
+        commands.remove<Health>(entities[1]);
+        commands.remove<Position>(entities[1]);
+        commands.destroy(entities[2]);
+        commands.destroy(entities[2]);
+        REQUIRE(reg.size() == 100);
+        REQUIRE_FALSE(commands.empty());
+
+        commands.playback();
+        REQUIRE(commands.empty());
+        REQUIRE(reg.size() == 101);
+        REQUIRE(reg.valid(spawned));
+        REQUIRE(reg.valid(empty));
+        REQUIRE(reg.empty(empty));
+        REQUIRE(reg.get<Position>(spawned) == Position{1, 2});
+        REQUIRE(reg.get<Velocity>(spawned) == Velocity{3, 4});
+        REQUIRE(reg.get<Tag>(spawned).s == "spawned");
+        REQUIRE(reg.get<Tag>(entities[0]).s == "first");
+        REQUIRE(reg.get<Velocity>(entities[0]) == Velocity{1, 1});
+        REQUIRE(reg.empty(entities[1]));
+        REQUIRE_FALSE(reg.valid(entities[2]));
+        REQUIRE(reg.count<Position, Velocity, Tag>() == 2);
+
+        // commands on entities destroyed meanwhile are dropped
+        commands.emplace<Tag>(entities[3], "late");
+        commands.remove<Health>(entities[3]);
+        commands.destroy(entities[3]);
+        reg.destroy(entities[3]);
+        commands.playback();
+        REQUIRE_FALSE(reg.valid(entities[3]));
+
+        REQUIRE_THROWS_AS((commands.emplace<Position>(entities[4]), commands.playback()), EcsException);
+    }
+    SECTION("merged commands")
+    {
+        ecs::command_buffer commands{reg};
+        // replace a component
+        commands.remove<Position>(entities[0]);
+        commands.emplace<Position>(entities[0], 7.0f, 7.0f);
+        // undo an emplace
+        commands.emplace<Tag>(entities[1], "undone");
+        commands.remove<Tag>(entities[1]);
+        // replace twice, then remove
+        commands.remove<Health>(entities[2]);
+        commands.emplace<Health>(entities[2], 1u);
+        commands.remove<Health>(entities[2]);
+        commands.emplace<Health>(entities[2], 2u);
+        commands.remove<Health>(entities[2]);
+        // emplace on a created entity and replace it
+        auto const spawned = commands.create(Velocity{1, 1});
+        commands.remove<Velocity>(spawned);
+        commands.emplace<Velocity>(spawned, 2.0f, 2.0f);
+        commands.playback();
+
+        REQUIRE(reg.get<Position>(entities[0]) == Position{7, 7});
+        REQUIRE(reg.get<Health>(entities[0]).hp == 0);
+        REQUIRE_FALSE(reg.has<Tag>(entities[1]));
+        REQUIRE((reg.has<Position>(entities[1]) && reg.has<Health>(entities[1])));
+        REQUIRE_FALSE(reg.has<Health>(entities[2]));
+        REQUIRE(reg.has<Position>(entities[2]));
+        REQUIRE(reg.get<Velocity>(spawned) == Velocity{2, 2});
+        REQUIRE(reg.count<Health>() == 99);
+        REQUIRE(reg.count<Velocity>() == 1);
+
+        // a failing playback applies nothing and clears the buffer
+        auto const size = reg.size();
+        auto const dropped = commands.create(Tag{"dropped"});
+        commands.emplace<Velocity>(entities[3], 1.0f, 1.0f);
+        commands.destroy(entities[4]);
+        commands.emplace<Position>(entities[5]);
+        REQUIRE_THROWS_AS(commands.playback(), EcsException);
+        REQUIRE(commands.empty());
+        REQUIRE(reg.size() == size);
+        REQUIRE_FALSE(reg.valid(dropped));
+        REQUIRE_FALSE(reg.has<Velocity>(entities[3]));
+        REQUIRE(reg.valid(entities[4]));
+        REQUIRE(reg.count<Tag>() == 0);
+        commands.create(Tag{"after"});
+        commands.playback();
+        REQUIRE(reg.count<Tag>() == 1);
+    }
+    SECTION("clear")
+    {
+        ecs::command_buffer commands{reg};
+        auto const reserved = commands.create(Tag{std::string(100, 'x')});
+        commands.destroy(entities[0]);
+        commands.clear();
+        REQUIRE(commands.empty());
+        commands.playback();
+        REQUIRE(reg.valid(entities[0]));
+        REQUIRE(reg.create<>() == reserved);
+    }
+    SECTION("parallel recording")
+    {
+        ecs::thread_pool pool(3);
+        std::vector<ecs::command_buffer> buffers;
+        for(std::size_t i = 0; i < pool.size(); ++i)
+            buffers.emplace_back(reg);
+        std::vector<std::vector<ecs::entity>> spawned(buffers.size());
+        pool.parallel_for(buffers.size(), [&](std::size_t index) {
+            for(std::size_t i = index; i < entities.size(); i += buffers.size())
+            {
+                auto const e = entities[i];
+                if(reg.get<Health>(e).hp % 2)
+                    buffers[index].destroy(e);
+                else
+                    spawned[index].push_back(buffers[index].create(Position{reg.get<Position>(e).x, 1}, Velocity{}));
+            }
+        });
+        for(auto &buffer : buffers)
+            buffer.playback();
+
+        std::set<ecs::entity> unique;
+        for(auto const &list : spawned)
+            unique.insert(list.begin(), list.end());
+        REQUIRE(unique.size() == 50);
+        REQUIRE(reg.size() == 100);
+        REQUIRE(reg.count<Position, Velocity>() == 50);
+        REQUIRE(reg.count<Health>() == 50);
+        for(auto [e, position, velocity] : reg.view<Position, Velocity>().each())
+            REQUIRE(position.y == 1);
+    }
+    SECTION("owning groups")
+    {
+        auto group = reg.group<Position, Velocity>();
+        ecs::command_buffer commands{reg};
+        commands.create(Position{}, Velocity{});
+        commands.emplace<Velocity>(entities[5]);
+        commands.remove<Position>(entities[6]);
+        commands.playback();
+        REQUIRE(group.size() == 2);
+        commands.remove<Velocity>(entities[5]);
+        commands.playback();
+        REQUIRE(group.size() == 1);
+        REQUIRE(reg.count<Position, Velocity>() == 1);
+    }
+}
+
+TEST_CASE("Double buffered storage", "[ecs][ecs::double_buffered]")
+{
+    // a one dimensional automaton, every cell becomes the xor of its neighbours
+    constexpr int size = 64;
+    ecs::registry reg;
+    std::vector<ecs::entity> cells;
+    std::vector<int> expected(size);
+    for(int i = 0; i < size; ++i)
+    {
+        expected[i] = i == size / 2;
+        cells.push_back(reg.create(Cell{expected[i]}));
+    }
+    auto &storage = reg.storage<Cell>();
+    REQUIRE(storage.read().get(cells[size / 2]).alive == 1);
+    REQUIRE(storage.write().get(cells[size / 2]).alive == 1);
+
+    ecs::thread_pool pool(3);
+    for(int step = 0; step < 20; ++step)
+    {
+        auto previous = storage.read();
+        auto next = storage.write();
+        pool.parallel_for(size, [&](std::size_t i) {
+            int left = i > 0 ? previous.get(cells[i - 1]).alive : 0;
+            int right = i + 1 < size ? previous.get(cells[i + 1]).alive : 0;
+            next.get(cells[i]).alive = left ^ right;
+        });
+        storage.swap();
+
+        std::vector<int> last = expected;
+        for(int i = 0; i < size; ++i)
+            expected[i] = (i > 0 ? last[i - 1] : 0) ^ (i + 1 < size ? last[i + 1] : 0);
+    }
+    for(int i = 0; i < size; ++i)
+        REQUIRE(reg.get<Cell>(cells[i]).alive == expected[i]);
+
+    // erasing keeps both buffers at the same index
+    storage.write().get(cells.back()).alive = 42;
+    reg.destroy(cells[3]);
+    reg.remove<Cell>(cells[10]);
+    REQUIRE(storage.size() == size - 2);
+    REQUIRE(storage.write().get(cells.back()).alive == 42);
+    REQUIRE(storage.read().get(cells.back()).alive == expected.back());
+    REQUIRE(std::distance(storage.read().begin(), storage.read().end()) == size - 2);
+    int const stale = storage.write().get(cells[11]).alive;
+    storage.swap();
+    REQUIRE(reg.get<Cell>(cells.back()).alive == 42);
+    REQUIRE(reg.get<Cell>(cells[11]).alive == stale);
+    REQUIRE(storage.write().get(cells[11]).alive == expected[11]);
+
+    ecs::registry copy = reg;
+    REQUIRE(copy.get<Cell>(cells.back()).alive == 42);
+    REQUIRE(reg.memory_usage().total() > 0);
+
+    // copied and staged entities keep their next value
+    storage.write().get(cells.back()).alive = 7;
+    auto const copied = reg.copy(cells.back(), reg);
+    ecs::staging_registry staging{reg};
+    auto const staged = staging.create(Cell{1});
+    staging.staged().storage<Cell>().write().get(staged).alive = 8;
+    staging.commit();
+    storage.swap();
+    REQUIRE(reg.get<Cell>(copied).alive == 7);
+    REQUIRE(reg.get<Cell>(staged).alive == 8);
+    REQUIRE(storage.write().get(copied).alive == 42);
+    REQUIRE(storage.write().get(staged).alive == 1);
+}
+
+TEST_CASE("Staging registries", "[ecs][ecs::staging_registry]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(int i = 0; i < 10; ++i)
+        entities.push_back(reg.create(Position{float(i), 0}));
+
+    SECTION("commit")
+    {
+        ecs::staging_registry staging{reg};
+        REQUIRE(staging.empty());
+        auto const a = staging.create(Position{1, 2}, Velocity{3, 4});
+        auto const b = staging.create<Position, Health>();
+        auto const c = staging.create(Tag{"staged"});
+        auto const d = staging.create(Material{{1, 0, 0, 1}, 3}, Anchor{7});
+        staging.emplace<Velocity>(c, 5.0f, 6.0f);
+        staging.get<Health>(b).hp = 9;
+        REQUIRE(staging.has<Velocity>(c));
+        REQUIRE(staging.size() == 4);
+        REQUIRE(staging.staged().count<Velocity>() == 2);
+        REQUIRE_FALSE(reg.valid(a));
+        REQUIRE_THROWS_AS(staging.create(Position{}, Position{}), EcsException);
+
+        staging.commit();
+        REQUIRE(staging.empty());
+        REQUIRE(reg.size() == 14);
+        REQUIRE(reg.get<Position>(a) == Position{1, 2});
+        REQUIRE(reg.get<Velocity>(a) == Velocity{3, 4});
+        REQUIRE(reg.get<Health>(b).hp == 9);
+        REQUIRE(reg.get<Tag>(c).s == "staged");
+        REQUIRE(reg.get<Velocity>(c) == Velocity{5, 6});
+        REQUIRE(reg.get<Material>(d).shader == 3);
+        REQUIRE(reg.get<Anchor>(d).id == 7);
+        REQUIRE(reg.count<Position>() == 12);
+        REQUIRE(reg.count<Velocity>() == 2);
+        REQUIRE(reg.view<Position, Velocity>().to_vector() == std::vector<ecs::entity>{a});
+
+        // the committed entities behave like any other
+        reg.remove<Position>(a);
+        reg.destroy(b);
+        REQUIRE(reg.count<Position>() == 10);
+        REQUIRE(reg.get<Position>(entities.back()).x == 9);
+    }
+    SECTION("destroy and clear")
+    {
+        ecs::staging_registry staging{reg};
+        auto const destroyed = staging.create(Position{});
+        auto const kept = staging.create(Position{});
+        staging.destroy(destroyed);
+        REQUIRE_FALSE(staging.valid(destroyed));
+        staging.commit();
+        REQUIRE(reg.valid(kept));
+        REQUIRE_FALSE(reg.valid(destroyed));
+        REQUIRE(reg.create<>() == destroyed);
+
+        auto const dropped = staging.create(Velocity{});
+        staging.clear();
+        REQUIRE(staging.empty());
+        staging.commit();
+        REQUIRE_FALSE(reg.valid(dropped));
+        REQUIRE(reg.create<>() == dropped);
+    }
+    SECTION("parallel staging")
+    {
+        auto group = reg.group<Position, Velocity>();
+        ecs::thread_pool pool(3);
+        std::vector<ecs::staging_registry> stagings;
+        for(std::size_t i = 0; i < pool.size(); ++i)
+            stagings.emplace_back(reg);
+        pool.parallel_for(stagings.size(), [&](std::size_t index) {
+            for(int i = 0; i < 1000; ++i)
+            {
+                if(i % 2)
+                    stagings[index].create(Position{float(index), float(i)}, Velocity{});
+                else
+                    stagings[index].create(Health{unsigned(i)});
+            }
+        });
+        for(auto &staging : stagings)
+            staging.commit();
+
+        REQUIRE(reg.size() == 10 + 1000 * stagings.size());
+        REQUIRE(reg.count<Health>() == 500 * stagings.size());
+        REQUIRE(group.size() == 500 * stagings.size());
+        std::set<ecs::entity> unique;
+        for(auto [e, position, velocity] : reg.view<Position, Velocity>().each())
+        {
+            unique.insert(e);
+            REQUIRE(int(position.y) % 2 == 1);
+        }
+        REQUIRE(unique.size() == 500 * stagings.size());
+    }
+    SECTION("large target")
+    {
+        for(int i = 0; i < 100'000; ++i)
+            reg.create(Position{});
+        ecs::staging_registry staging{reg};
+        auto const first = staging.create(Velocity{});
+        auto const second = staging.create(Velocity{});
+        // the staged records start at the staged identifiers
+        REQUIRE(staging.staged().memory_usage().entities.denseBytes * 10 < reg.memory_usage().entities.denseBytes);
+        staging.commit();
+        auto const third = staging.create(Velocity{1, 0});
+        REQUIRE(staging.valid(third));
+        REQUIRE_FALSE(staging.valid(first));
+        staging.commit();
+        REQUIRE(reg.valid(first));
+        REQUIRE(reg.valid(second));
+        REQUIRE(reg.get<Velocity>(third) == Velocity{1, 0});
+    }
+}
+
+TEST_CASE("Snapshots", "[ecs][ecs::snapshot]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(int i = 0; i < 100; ++i)
+    {
+        if(i % 2)
+            entities.push_back(reg.create(Position{float(i), 0}, Velocity{1, 0}, Tag{"odd"}));
+        else
+            entities.push_back(reg.create(Position{float(i), 0}));
+    }
+
+    ecs::snapshot<Position, Velocity> frame;
+    REQUIRE(frame.size() == 0);
+    frame.extract(reg);
+    REQUIRE(frame.size() == 100);
+    REQUIRE(frame.has<Tag>(entities[1]));
+    REQUIRE(frame.get<Position>(entities[1]) == Position{1, 0});
+
+    // the live registry keeps changing
+    reg.view<Position, Velocity>().each([](Position &position, Velocity const &velocity) { position.x += velocity.dx * 1000; });
+    auto const spawned = reg.create(Position{}, Velocity{});
+    reg.destroy(entities[3]);
+    reg.remove<Velocity>(entities[5]);
+    REQUIRE(frame.valid(entities[3]));
+    REQUIRE_FALSE(frame.valid(spawned));
+    REQUIRE(frame.get<Velocity>(entities[5]) == Velocity{1, 0});
+    REQUIRE(frame.view<Position, Velocity>().size() == 50);
+    float sum = 0;
+    frame.view<Position, Velocity>().each([&](Position const &position, Velocity const &) { sum += position.x; });
+    REQUIRE(sum == 2500);
+    REQUIRE(frame.view<Position>(ecs::exclude<Tag>{}).to_vector().size() == 50);
+
+    frame.extract(reg);
+    REQUIRE_FALSE(frame.valid(entities[3]));
+    REQUIRE(frame.valid(spawned));
+    REQUIRE(frame.view<Position, Velocity>().size() == 49);
+    REQUIRE(frame.get<Position>(entities[1]).x == 1001);
+    REQUIRE(frame.memory_usage().total() > 0);
+
+    SECTION("arranged source")
+    {
+        reg.arrange();
+        frame.extract(reg);
+        std::vector<ecs::entity> live, copied;
+        for(auto [e, position, velocity] : reg.view<Position, Velocity>().each())
+            live.push_back(e);
+        for(auto [e, position, velocity] : frame.view<Position, Velocity>().each())
+            copied.push_back(e);
+        REQUIRE(copied == live);
+    }
+    SECTION("missing arrays")
+    {
+        ecs::registry positions;
+        positions.create(Position{});
+        frame.extract(positions);
+        REQUIRE(frame.size() == 1);
+        REQUIRE(frame.view<Velocity>().size() == 0);
+        REQUIRE(frame.storage<Velocity>().size() == 0);
+    }
+    SECTION("rendering while simulating")
+    {
+        std::atomic<bool> extracted{false}, rendered{false};
+        std::atomic<int> mismatches{0};
+        std::thread render([&] {
+            while(!extracted) std::this_thread::yield();
+            frame.view<Position, Velocity>().each([&](ecs::entity e, Position const &position, Velocity const &) {
+                if(position.x != float(e) + 1000 - 1 && e != spawned)
+                    ++mismatches;
+            });
+            rendered = true;
+        });
+        extracted = true;
+        while(!rendered)
+            reg.view<Position>().each([](Position &position) { position.x += 1; });
+        render.join();
+        REQUIRE(mismatches == 0);
+    }
+}
+
+TEST_CASE("Event queues", "[ecs][ecs::event_queue]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(unsigned i = 0; i < 100; ++i)
+        entities.push_back(reg.create(Health{100}));
+    auto &hits = ecs::events<Hit>(reg);
+    REQUIRE(&hits == &ecs::events<Hit>(reg));
+    REQUIRE(hits.empty());
+
+    SECTION("parallel pushes")
+    {
+        ecs::thread_pool pool(3);
+        for(int frame = 0; frame < 3; ++frame)
+        {
+            reg.view<Health>().par_each(pool, [&](ecs::entity e, Health const &) {
+                for(int i = 0; i < 10; ++i)
+                    hits.push_to(reg, e, 1u, "par_each");
+                hits.push(0u, "push");
+            }, 8);
+            REQUIRE(hits.size() == 1100);
+
+            std::size_t spans = 0, untargeted = 0;
+            hits.drain(reg, [&](ecs::event_queue<Hit>::span span) {
+                ++spans;
+                REQUIRE(span.size() <= ecs::event_queue<Hit>::CHUNK_SIZE);
+                for(std::size_t i = 0; i < span.size(); ++i)
+                {
+                    if(span.target(i) == ecs::event_queue<Hit>::NO_TARGET)
+                        ++untargeted;
+                    else
+                        reg.get<Health>(span.target(i)).hp -= span[i].damage;
+                }
+            });
+            REQUIRE(spans >= 1100 / ecs::event_queue<Hit>::CHUNK_SIZE);
+            REQUIRE(untargeted == 100);
+            REQUIRE(hits.empty());
+        }
+        for(auto [e, health] : reg.view<Health>().each())
+            REQUIRE(health.hp == 70);
+    }
+    SECTION("destroyed targets")
+    {
+        for(unsigned i = 0; i < 600; ++i)
+            hits.push_to(reg, entities[i % 100], i, std::string(32, 'x'));
+        reg.destroy(entities[0]);
+        reg.destroy(entities[50]);
+        std::size_t count = 0;
+        unsigned sum = 0;
+        hits.drain(reg, [&](auto span) {
+            for(Hit &hit : span)
+            {
+                REQUIRE(hit.source.size() == 32);
+                sum += hit.damage;
+            }
+            count += span.size();
+        });
+        REQUIRE(count == 588);
+        REQUIRE(sum == 599 * 600 / 2 - (0 + 100 + 200 + 300 + 400 + 500) - (50 + 150 + 250 + 350 + 450 + 550));
+
+        // the identifier of a destroyed target is reused right away, the event does not go to the new entity
+        hits.push_to(reg, entities[1], 1u, "stale");
+        reg.destroy(entities[1]);
+        REQUIRE(reg.create(Health{100}) == entities[1]);
+        hits.push_to(reg, entities[1], 2u, "fresh");
+        count = 0;
+        hits.drain(reg, [&](auto span) {
+            count += span.size();
+            REQUIRE(span[0].source == "fresh");
+        });
+        REQUIRE(count == 1);
+    }
+    SECTION("failures")
+    {
+        struct Fragile { Fragile(bool fail) : value(std::make_unique<int>(1)) { if(fail) throw std::runtime_error("fragile"); } std::unique_ptr<int> value; };
+        auto &fragile = ecs::events<Fragile>(reg);
+        fragile.push(false);
+        REQUIRE_THROWS_AS(fragile.push(true), std::runtime_error);
+        fragile.push(false);
+        REQUIRE(fragile.size() == 3);
+        std::size_t count = 0;
+        fragile.drain(reg, [&](auto span) { count += span.size(); });
+        REQUIRE(count == 2);
+
+        for(unsigned i = 0; i < 1000; ++i)
+            hits.push(i, "loop");
+        REQUIRE_THROWS_AS(hits.drain(reg, [](auto) { throw std::runtime_error("consumer"); }), std::runtime_error);
+        REQUIRE(hits.empty());
+        hits.push(1u, "after");
+        REQUIRE(hits.size() == 1);
+        hits.clear();
+
+        // a throw on a later span drops the chunks after the drained ones too
+        for(unsigned i = 0; i < 1000; ++i)
+            hits.push(i, "loop");
+        std::size_t spans = 0;
+        REQUIRE_THROWS_AS(hits.drain(reg, [&](auto) { if(++spans == 2) throw std::runtime_error("consumer"); }), std::runtime_error);
+        REQUIRE(hits.empty());
+        REQUIRE(hits.size() == 0);
+        hits.push(1u, "after");
+        count = 0;
+        hits.drain(reg, [&](auto span) { count += span.size(); });
+        REQUIRE(count == 1);
+    }
+    SECTION("copy")
+    {
+        hits.push_to(reg, entities[1], 5u, "copied");
+        ecs::registry copy = reg;
+        hits.clear();
+        auto &copied = ecs::events<Hit>(copy);
+        REQUIRE(copied.size() == 1);
+        copied.drain(copy, [&](auto span) {
+            REQUIRE(span.target(0) == entities[1]);
+            REQUIRE(span[0].source == "copied");
+        });
+    }
+}
+
+TEST_CASE("Deterministic mode", "[ecs][ecs::registry]")
+{
+    SECTION("provisional identifiers")
+    {
+        ecs::registry reg;
+        reg.set_deterministic();
+        REQUIRE(reg.deterministic());
+        auto const first = reg.create<Position>();
+        ecs::command_buffer commands{reg};
+        auto const spawned = commands.create(Position{1, 1});
+        auto const dropped = commands.create();
+        commands.emplace<Velocity>(spawned, 2.0f, 0.0f);
+        commands.remove<Position>(spawned);
+        commands.destroy(dropped);
+        commands.emplace<Tag>(first, "first");
+        REQUIRE_FALSE(reg.valid(spawned));
+        REQUIRE(reg.size() == 1);
+
+        commands.playback();
+        auto const resolved = commands.resolve(spawned);
+        REQUIRE(reg.valid(resolved));
+        REQUIRE(reg.get<Velocity>(resolved) == Velocity{2, 0});
+        REQUIRE_FALSE(reg.has<Position>(resolved));
+        REQUIRE_FALSE(reg.valid(commands.resolve(dropped)));
+        REQUIRE(commands.resolve(first) == first);
+        REQUIRE(reg.get<Tag>(first).s == "first");
+
+        commands.create();
+        commands.clear();
+        REQUIRE(commands.resolve(spawned) == resolved);
+
+        ecs::command_buffer other{reg};
+        other.emplace<Tag>(spawned, "foreign");
+        REQUIRE_THROWS_AS(other.playback(), EcsException);
+        REQUIRE(other.empty());
+    }
+    SECTION("views walk the groups")
+    {
+        // the tagged entities left their groups, a pivot over the tags is cheaper than the groups
+        ecs::registry reg;
+        for(int i = 0; i < 100; ++i)
+            reg.create(Position{}, Velocity{});
+        for(int i = 0; i < 8; ++i)
+        {
+            auto const e = reg.create(Position{}, Tag{});
+            if(i & 1) reg.emplace<Health>(e);
+            if(i & 2) reg.emplace<Velocity>(e);
+            if(i & 4) reg.emplace<Anchor>(e);
+            if(i != 0) reg.destroy(e);
+        }
+        REQUIRE(reg.view<Position, Tag>().plan().kind == ecs::view_plan::strategy::pivot);
+        reg.set_deterministic();
+        REQUIRE(reg.view<Position, Tag>().plan().kind == ecs::view_plan::strategy::group_scan);
+        REQUIRE(reg.view<Position, Tag>().size() == 1);
+        ecs::query any;
+        any.any<Tag, Velocity>();
+        REQUIRE(reg.view(any).to_vector() == reg.view<>().to_vector());
+    }
+    SECTION("parallel simulation")
+    {
+        // the same frames on a different number of threads give the same registry
+        auto simulate = [](std::size_t threads) {
+            ecs::registry reg;
+            reg.set_deterministic();
+            for(unsigned i = 0; i < 300; ++i)
+                reg.create(Position{float(i), 0}, Health{i % 11});
+            ecs::thread_pool pool(threads);
+            for(int frame = 0; frame < 6; ++frame)
+            {
+                reg.view<Position, Health>().par_each_commands(pool, [&](ecs::command_buffer &commands, ecs::entity e, Position &position, Health &health) {
+                    position.x += 1;
+                    if(health.hp == 0)
+                    {
+                        commands.destroy(e);
+                        return;
+                    }
+                    --health.hp;
+                    if(health.hp % 3 == 0)
+                    {
+                        auto const child = commands.create(Position{position.x, position.y + 1}, Health{health.hp});
+                        commands.emplace<Velocity>(child, float(e), 0.0f);
+                        commands.then([&reg, e, child](ecs::command_buffer const &played) {
+                            if(reg.has<Anchor>(e))
+                                reg.get<Anchor>(e).id = int(played.resolve(child));
+                            else
+                                reg.emplace<Anchor>(e, int(played.resolve(child)));
+                        });
+                    }
+                    else if(health.hp % 3 == 1 && !reg.has<Tag>(e))
+                        commands.emplace<Tag>(e, "odd");
+                    else if(health.hp % 3 == 2 && reg.has<Tag>(e))
+                        commands.remove<Tag>(e);
+                }, 16);
+            }
+            std::vector<std::tuple<ecs::entity, float, float, unsigned, bool, float, int>> state;
+            for(auto [e, position, health] : reg.view<Position, Health>().each())
+            {
+                int child = reg.has<Anchor>(e) ? reg.get<Anchor>(e).id : -1;
+                // the last child spawned by a parent knows it
+                if(child != -1 && reg.valid(ecs::entity(child)))
+                    REQUIRE(reg.get<Velocity>(ecs::entity(child)).dx == float(e));
+                state.emplace_back(e, position.x, position.y, health.hp, reg.has<Tag>(e), reg.has<Velocity>(e) ? reg.get<Velocity>(e).dx : -1.0f, child);
+            }
+            return state;
+        };
+        auto const serial = simulate(1);
+        REQUIRE(serial.size() > 300);
+        REQUIRE(simulate(3) == serial);
+        REQUIRE(simulate(4) == serial);
+    }
+}
+
+TEST_CASE("Owning groups", "[ecs][ecs::registry]")
+{
+    ecs::registry reg;
+    std::vector<ecs::entity> entities;
+    for(int i = 0; i < 20; ++i)
+    {
+        auto e = reg.create(Position{float(i), 0});
+        if(i % 3 == 0)
+            reg.emplace<Velocity>(e, 1.0f, 0.0f);
+        entities.push_back(e);
+    }
+    auto lone = reg.create(Velocity{2, 0});
+
+    // the entities with both components are the same prefix of both arrays
+    auto isPacked = [&](std::size_t size) {
+        auto const &positions = reg.storage<Position>().sparse();
+        auto const &velocities = reg.storage<Velocity>().sparse();
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            if(positions[i] != velocities[i] || !reg.has<Velocity>(positions[i]))
+                return false;
+        }
+        return true;
+    };
+
+    auto group = reg.group<Position, Velocity>();
+    REQUIRE(group.size() == reg.view<Position, Velocity>().size());
+    REQUIRE(isPacked(group.size()));
+    REQUIRE(std::find(group.begin(), group.end(), lone) == group.end());
+
+    reg.emplace<Position>(lone, 100.0f, 0.0f);
+    reg.remove<Velocity>(entities[3]);
+    reg.destroy(entities[6]);
+    reg.emplace<Velocity>(entities[1], 1.0f, 0.0f);
+    REQUIRE(group.size() == 7);
+    REQUIRE(isPacked(group.size()));
+    auto grouped = group.to_vector();
+    auto viewed = reg.view<Position, Velocity>().to_vector();
+    std::sort(grouped.begin(), grouped.end());
+    std::sort(viewed.begin(), viewed.end());
+    REQUIRE(grouped == viewed);
+
+    group.each([](Position &position, Velocity const &velocity) { position.x += velocity.dx; });
+    REQUIRE(reg.get<Position>(lone).x == 102.0f);
+    group.each([&](ecs::entity e, Position const &position, Velocity const &) { REQUIRE(&position == &reg.get<Position>(e)); });
+
+    // the same group is returned, the groups are copied with the registry
+    REQUIRE(reg.group<Position, Velocity>().size() == group.size());
+    REQUIRE(reg.getOwningGroups().size() == 1);
+    ecs::registry copy = reg;
+    copy.destroy(lone);
+    REQUIRE(copy.group<Position, Velocity>().size() == 6);
+    REQUIRE(group.size() == 7);
+
+    reg.clear();
+    REQUIRE(group.empty());
+}
+
 TEST_CASE("Registry example", "[ecs][ecs::registry]")
 {
     ecs::registry registry;
@@ -459,6 +1935,25 @@ TEST_CASE("Registry example", "[ecs][ecs::registry]")
         registry.get<Position>(e).x += registry.get<Velocity>(e).dx;
         registry.get<Position>(e).y += registry.get<Velocity>(e).dy;
     }
+
+    view.each([](Position &position, Velocity const &velocity) {
+        position.x += velocity.dx;
+        position.y += velocity.dy;
+    });
+
+    for(auto [entity, position, velocity] : view.each())
+    {
+        position.x += velocity.dx;
+        position.y += velocity.dy;
+    }
+
+    std::size_t visited = 0;
+    std::as_const(registry).view<Position, Velocity>(ecs::exclude<Tag>{}).each([&](ecs::entity entity, Position const &position, Velocity const &velocity) {
+        REQUIRE(registry.valid(entity));
+        REQUIRE(position.x >= velocity.dx * 3);
+        ++visited;
+    });
+    REQUIRE(visited == 4);
 }
 
 /** \endcond */
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <stdexcept>
+#include <vector>
+#include <functional>
 
 // operators == are for testing only.
 
@@ -22,6 +24,47 @@ struct Health {
     unsigned hp; 
 };
 
+// storage_traits specializations are in tests.cpp.
+
+struct Boss {
+    unsigned level = 0;
+};
+
+struct Input {
+    float axis = 0;
+};
+
+struct Terrain {
+    std::vector<float> heights;
+};
+
+struct Anchor {
+    int id = 0;
+};
+
+struct Material {
+    float color[4];
+    unsigned shader;
+    bool operator==(Material const& o) const { return color[0] == o.color[0] && color[1] == o.color[1] && color[2] == o.color[2] && color[3] == o.color[3] && shader == o.shader; }
+};
+template<> struct std::hash<Material> {
+    std::size_t operator()(Material const &m) const {
+        std::size_t hash = std::hash<unsigned>{}(m.shader);
+        for(float c : m.color)
+            hash = hash * 31 + std::hash<float>{}(c);
+        return hash;
+    }
+};
+
+struct Cell {
+    int alive = 0;
+};
+
+struct Hit {
+    unsigned damage = 0;
+    std::string source;
+};
+
 struct EcsException : std::logic_error { 
     EcsException() = delete;
     EcsException(char const *) = delete;